@@ -0,0 +1,900 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define LEXER_BENCH_HAS_RUSAGE 1
+#else
+#define LEXER_BENCH_HAS_RUSAGE 0
+#endif
+
+#include "arena.hpp"
+#include "batch.hpp"
+#include "lexer.hpp"
+#include "parallel.hpp"
+#include "rule_set.hpp"
+#include "static_lexer.hpp"
+#include "token_cache.hpp"
+
+/// @brief The number of calls to operator new since the program started.
+static std::atomic<std::size_t> allocation_count{0};
+
+/**
+ * @brief Counts an allocation and makes it with std::malloc, or with
+ * std::aligned_alloc for alignments malloc does not guarantee, so that every
+ * replaced operator delete can release it with std::free.
+ *
+ * @return The memory, or nullptr if it could not be allocated.
+ */
+static void* counted_allocate(std::size_t size, std::size_t alignment)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+    if (size == 0)
+        size = 1;
+
+    if (alignment <= alignof(std::max_align_t))
+        return std::malloc(size);
+
+    return std::aligned_alloc(alignment,
+                              (size + alignment - 1) / alignment * alignment);
+}
+
+static void* counted_allocate_or_throw(std::size_t size, std::size_t alignment)
+{
+    if (void* memory = counted_allocate(size, alignment))
+        return memory;
+
+    throw std::bad_alloc();
+}
+
+// Every form of operator new is replaced below and every one of them
+// allocates with malloc or aligned_alloc, so every form of operator delete
+// can free what any of them returned. GCC cannot see that across the
+// replacements and warns about each pairing it considers mismatched.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+    return counted_allocate_or_throw(size, alignof(std::max_align_t));
+}
+
+void* operator new[](std::size_t size)
+{
+    return counted_allocate_or_throw(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    return counted_allocate_or_throw(size,
+                                     static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return counted_allocate_or_throw(size,
+                                     static_cast<std::size_t>(alignment));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size,
+                   std::align_val_t alignment,
+                   const std::nothrow_t&) noexcept
+{
+    return counted_allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size,
+                     std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept
+{
+    return counted_allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+void operator delete[](void* memory, std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+void operator delete(void* memory, const std::nothrow_t&) noexcept
+{
+    std::free(memory);
+}
+void operator delete[](void* memory, const std::nothrow_t&) noexcept
+{
+    std::free(memory);
+}
+void operator delete(void* memory,
+                     std::align_val_t,
+                     const std::nothrow_t&) noexcept
+{
+    std::free(memory);
+}
+void operator delete[](void* memory,
+                       std::align_val_t,
+                       const std::nothrow_t&) noexcept
+{
+    std::free(memory);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+enum class BenchTokenType
+{
+    Whitespace,
+    Comment,
+    Keyword,
+    Identifier,
+    Number,
+    String,
+    Operator,
+    Punctuation,
+};
+
+static_assert(sizeof(TokenBuffer<BenchTokenType>::type_index_t) == 1,
+              "A TokenBuffer should store a byte per token type");
+
+/**
+ * @brief The rules every benchmark scans with, general enough to cover every
+ * corpus.
+ */
+struct BenchRules
+{
+    static constexpr StaticTokenDefinition<BenchTokenType> definitions[] = {
+        {BenchTokenType::Whitespace, "\\s+", true},
+        {BenchTokenType::Comment, "//[^\\n]*", true},
+        {BenchTokenType::Keyword,
+         "(?:true|false|null|int|return|if|else|for|while|const|auto)"},
+        {BenchTokenType::Identifier, "[a-zA-Z_][a-zA-Z0-9_]*"},
+        {BenchTokenType::Number, "-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?"},
+        {BenchTokenType::String, "\"([^\"\\\\\\n]|\\\\.)*\""},
+        {BenchTokenType::Operator,
+         "<<|>>|::|->|==|!=|<=|>=|&&|\\|\\||\\+\\+|--|\\+=|-="},
+        {BenchTokenType::Punctuation, "[^\\s\\w]"},
+    };
+};
+
+/**
+ * @brief Command line options.
+ */
+struct BenchOptions
+{
+    /// @brief The total size of every corpus.
+    std::size_t size = 16 << 20;
+    /// @brief The number of files every corpus is split into.
+    std::size_t files = 64;
+    /// @brief The number of times every benchmark runs.
+    std::size_t repeat = 3;
+    /// @brief The largest number of bytes the std::regex backend scans.
+    std::size_t regex_size = 1 << 20;
+    /// @brief Only run corpora and benchmarks whose name contains this.
+    std::string filter;
+    /// @brief Where to write the JSON report; empty for standard output.
+    std::string output;
+};
+
+/**
+ * @brief A named set of files to tokenize.
+ */
+struct Corpus
+{
+    std::string name;
+    std::vector<std::string> files;
+    /// @brief Where every file was written, for benchmarks that read files;
+    /// empty if they were not written.
+    std::vector<std::string> paths = {};
+};
+
+/**
+ * @brief The measurements of one benchmark over one corpus.
+ */
+struct BenchResult
+{
+    std::string corpus;
+    std::string benchmark;
+    std::size_t bytes = 0;
+    std::size_t tokens = 0;
+    double seconds = 0;
+    double p50_us = 0;
+    double p99_us = 0;
+    double allocations_per_token = 0;
+    /// @brief The peak resident set size while the benchmark ran, in KiB.
+    long peak_rss_kib = 0;
+    /// @brief Whether peak_rss_kib is that of the whole process so far,
+    /// because the peak could not be reset before the benchmark.
+    bool process_peak_rss = false;
+};
+
+/**
+ * @brief Tokenizes one file, given its content or its path, and returns the
+ * number of tokens.
+ */
+using BenchFunction = std::function<std::size_t(const std::string&)>;
+
+/**
+ * @brief Tokenizes the files at every path and returns the number of tokens.
+ */
+using CorpusFunction =
+    std::function<std::size_t(const std::vector<std::string>&)>;
+
+/**
+ * @brief A named way of tokenizing files.
+ */
+struct Benchmark
+{
+    std::string name;
+    /// @brief Tokenizes the content of one file.
+    BenchFunction run;
+    /// @brief The largest number of bytes to scan per repetition, 0 for all.
+    std::size_t max_bytes = 0;
+    /// @brief If set, tokenizes the file at a path instead of run().
+    BenchFunction run_path = {};
+    /// @brief If set, tokenizes every file of the corpus at once instead of
+    /// run().
+    CorpusFunction run_corpus = {};
+
+    /// @brief Whether the benchmark reads the corpus from disk.
+    bool reads_files() const { return run_path || run_corpus; }
+};
+
+/**
+ * @brief Restarts the peak resident set size from the current one, so that
+ * peak_rss_kib() measures what runs from here on.
+ *
+ * @return False if the peak cannot be reset on this system, in which case
+ * peak_rss_kib() keeps reporting the peak of the whole process.
+ */
+static bool reset_peak_rss()
+{
+#if defined(__linux__)
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5" << std::flush;
+
+    return static_cast<bool>(clear_refs);
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief The peak resident set size since the last reset_peak_rss(), or since
+ * the program started, in KiB.
+ */
+static long peak_rss_kib()
+{
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return std::strtol(line.c_str() + 6, nullptr, 10);
+    }
+#endif
+
+#if LEXER_BENCH_HAS_RUSAGE
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Generates files of about size / files bytes each, appending pieces
+ * produced by a generator until every file is full.
+ */
+static std::vector<std::string>
+generate(const BenchOptions& options,
+         const std::function<void(std::mt19937&, std::string&)>& piece)
+{
+    std::mt19937 random(42);
+    std::vector<std::string> files(std::max<std::size_t>(options.files, 1));
+    std::size_t file_size = options.size / files.size();
+
+    for (auto& file : files)
+    {
+        file.reserve(file_size + 256);
+
+        while (file.size() < file_size)
+            piece(random, file);
+    }
+
+    return files;
+}
+
+static std::string identifier(std::mt19937& random, std::size_t min_length)
+{
+    static const char letters[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+
+    std::size_t length = min_length + random() % 8;
+    std::string name(1, letters[random() % 52]);
+
+    while (name.size() < length)
+        name += letters[random() % (sizeof(letters) - 1)];
+
+    return name;
+}
+
+static Corpus cpp_corpus(const BenchOptions& options)
+{
+    static const char* const types[] = {"int", "auto", "const std::string&",
+                                        "std::vector<int>", "float"};
+
+    auto piece = [](std::mt19937& random, std::string& out)
+    {
+        std::string name = identifier(random, 3);
+
+        switch (random() % 5)
+        {
+        case 0:
+            out += "// " + identifier(random, 10) + " " +
+                   identifier(random, 6) + "\n";
+            break;
+        case 1:
+            out += "    " + std::string(types[random() % 5]) + " " + name +
+                   " = " + std::to_string(random() % 10000) + ";\n";
+            break;
+        case 2:
+            out += "    if (" + name + " >= " + identifier(random, 2) +
+                   ")\n    {\n        return " + name + "->size();\n    }\n";
+            break;
+        case 3:
+            out += "    for (int i = 0; i < " + name + ".size(); i++)\n" +
+                   "        std::cout << " + name + "[i] << \"\\n\";\n";
+            break;
+        default:
+            out += "    " + name + "(" + identifier(random, 4) + ", " +
+                   std::to_string(random() % 100) + "." +
+                   std::to_string(random() % 100) + ");\n";
+            break;
+        }
+    };
+
+    return {"cpp", generate(options, piece)};
+}
+
+static Corpus json_corpus(const BenchOptions& options)
+{
+    auto piece = [](std::mt19937& random, std::string& out)
+    {
+        out += "{\"id\": " + std::to_string(random() % 1000000) +
+               ", \"name\": \"" + identifier(random, 6) +
+               "\", \"active\": " + (random() % 2 ? "true" : "false") +
+               ", \"score\": " + std::to_string(random() % 1000) + "." +
+               std::to_string(random() % 1000) + "e-3, \"tags\": [\"" +
+               identifier(random, 3) + "\", \"" + identifier(random, 3) +
+               "\"], \"parent\": null},\n";
+    };
+
+    return {"json", generate(options, piece)};
+}
+
+static Corpus whitespace_corpus(const BenchOptions& options)
+{
+    auto piece = [](std::mt19937& random, std::string& out)
+    {
+        out.append(random() % 64, ' ');
+        out += identifier(random, 1);
+        out.append(random() % 4, '\n');
+        out.append(random() % 8, '\t');
+        out += ";";
+    };
+
+    return {"whitespace", generate(options, piece)};
+}
+
+static Corpus long_identifier_corpus(const BenchOptions& options)
+{
+    auto piece = [](std::mt19937& random, std::string& out)
+    {
+        out += identifier(random, 64 + random() % 192);
+        out += random() % 8 ? " " : "\n";
+    };
+
+    return {"long_identifiers", generate(options, piece)};
+}
+
+/**
+ * @brief Runs a benchmark over a corpus.
+ *
+ * Every repetition tokenizes each file once; the reported time is the fastest
+ * repetition, and the latencies are taken over every file of every
+ * repetition, or over every repetition for benchmarks of the whole corpus.
+ */
+static BenchResult run(const Corpus& corpus,
+                       const Benchmark& benchmark,
+                       const BenchOptions& options)
+{
+    using clock = std::chrono::steady_clock;
+
+    BenchResult result;
+    result.corpus = corpus.name;
+    result.benchmark = benchmark.name;
+
+    std::vector<double> latencies;
+    std::size_t allocations = 0;
+    std::size_t tokens = 0;
+    double best = 0;
+
+    result.process_peak_rss = !reset_peak_rss();
+
+    for (std::size_t r = 0; r < std::max<std::size_t>(options.repeat, 1); r++)
+    {
+        std::size_t bytes = 0;
+        std::size_t count = 0;
+        double total = 0;
+        std::size_t before = allocation_count.load();
+
+        if (benchmark.run_corpus)
+        {
+            auto start = clock::now();
+            count = benchmark.run_corpus(corpus.paths);
+            auto stop = clock::now();
+
+            total = std::chrono::duration<double>(stop - start).count();
+            latencies.push_back(total * 1e6);
+
+            for (const auto& file : corpus.files)
+                bytes += file.size();
+        }
+        else
+        {
+            for (std::size_t i = 0; i < corpus.files.size(); i++)
+            {
+                if (benchmark.max_bytes && bytes >= benchmark.max_bytes)
+                    break;
+
+                auto start = clock::now();
+                count += benchmark.run_path
+                             ? benchmark.run_path(corpus.paths[i])
+                             : benchmark.run(corpus.files[i]);
+                auto stop = clock::now();
+
+                double seconds =
+                    std::chrono::duration<double>(stop - start).count();
+                latencies.push_back(seconds * 1e6);
+                total += seconds;
+                bytes += corpus.files[i].size();
+            }
+        }
+
+        allocations = allocation_count.load() - before;
+        tokens = count;
+        result.bytes = bytes;
+
+        if (r == 0 || total < best)
+            best = total;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    auto percentile = [&](double p)
+    {
+        if (latencies.empty())
+            return 0.0;
+
+        auto index = static_cast<std::size_t>(p * (latencies.size() - 1));
+        return latencies[index];
+    };
+
+    result.tokens = tokens;
+    result.seconds = best;
+    result.p50_us = percentile(0.50);
+    result.p99_us = percentile(0.99);
+    result.allocations_per_token =
+        tokens ? static_cast<double>(allocations) / tokens : 0;
+    result.peak_rss_kib = peak_rss_kib();
+
+    return result;
+}
+
+/**
+ * @brief Creates a directory of its own for the files of this run, so that
+ * concurrent runs do not remove each other's files.
+ *
+ * @return The directory, or an empty path if none could be created.
+ */
+static std::filesystem::path make_run_directory()
+{
+    std::random_device random;
+    std::error_code error;
+    auto temporary = std::filesystem::temp_directory_path(error);
+
+    for (int attempt = 0; !error && attempt < 100; attempt++)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "lexer_bench_%08x%08x", random(),
+                      random());
+
+        // Fails rather than reuses a directory that already exists.
+        if (std::filesystem::create_directory(temporary / name, error))
+            return temporary / name;
+    }
+
+    return {};
+}
+
+/**
+ * @brief Writes every file of a corpus to a directory, for the benchmarks that
+ * read files, and records where.
+ */
+static bool write_files(Corpus& corpus, const std::filesystem::path& directory)
+{
+    for (std::size_t i = 0; i < corpus.files.size(); i++)
+    {
+        auto path = directory / (corpus.name + "_" + std::to_string(i));
+        std::ofstream out(path, std::ios::binary);
+        out.write(corpus.files[i].data(), corpus.files[i].size());
+
+        if (!out)
+        {
+            std::cerr << "Could not write " << path.string() << std::endl;
+            return false;
+        }
+
+        corpus.paths.push_back(path.string());
+    }
+
+    return true;
+}
+
+static void write_json(std::ostream& out,
+                       const BenchOptions& options,
+                       const std::vector<BenchResult>& results)
+{
+    out << "{\n";
+    out << "  \"config\": {\"size\": " << options.size
+        << ", \"files\": " << options.files << ", \"repeat\": "
+        << options.repeat << ", \"regex_size\": " << options.regex_size
+        << "},\n";
+    out << "  \"results\": [";
+
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& result = results[i];
+        double seconds = result.seconds > 0 ? result.seconds : 1e-9;
+
+        out << (i ? ",\n" : "\n");
+        out << "    {\"corpus\": \"" << result.corpus
+            << "\", \"benchmark\": \"" << result.benchmark
+            << "\", \"bytes\": " << result.bytes
+            << ", \"tokens\": " << result.tokens
+            << ", \"seconds\": " << result.seconds
+            << ", \"mb_per_s\": " << result.bytes / seconds / 1e6
+            << ", \"tokens_per_s\": " << result.tokens / seconds
+            << ", \"p50_us\": " << result.p50_us
+            << ", \"p99_us\": " << result.p99_us
+            << ", \"allocations_per_token\": " << result.allocations_per_token
+            << ", \"peak_rss_kib\": " << result.peak_rss_kib
+            << ", \"peak_rss_scope\": \""
+            << (result.process_peak_rss ? "process" : "benchmark") << "\"}";
+    }
+
+    out << "\n  ]\n}\n";
+}
+
+static void usage(const char* program)
+{
+    std::cerr << "Usage: " << program
+              << " [--size BYTES] [--files N] [--repeat N] [--regex-size BYTES]"
+                 " [--filter TEXT] [--output FILE]"
+              << std::endl;
+}
+
+static bool parse_options(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+
+        if (i + 1 >= argc)
+            return false;
+
+        const char* value = argv[++i];
+
+        if (arg == "--size")
+            options.size = std::strtoull(value, nullptr, 10);
+        else if (arg == "--files")
+            options.files = std::strtoull(value, nullptr, 10);
+        else if (arg == "--repeat")
+            options.repeat = std::strtoull(value, nullptr, 10);
+        else if (arg == "--regex-size")
+            options.regex_size = std::strtoull(value, nullptr, 10);
+        else if (arg == "--filter")
+            options.filter = value;
+        else if (arg == "--output")
+            options.output = value;
+        else
+            return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+
+    if (!parse_options(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    using lexer_t = Lexer<BenchTokenType>;
+    using view_lexer_t = Lexer<BenchTokenType, std::string_view>;
+
+    auto definitions = StaticScanner<BenchRules>::definitions();
+    auto dfa_rules = std::make_shared<const RuleSet<BenchTokenType>>(
+        definitions, LexerBackend::Dfa);
+    auto regex_rules = std::make_shared<const RuleSet<BenchTokenType>>(
+        definitions, LexerBackend::Regex);
+    auto static_rules = make_static_rule_set<BenchRules>();
+
+    lexer_t lexer(dfa_rules);
+    view_lexer_t view_lexer(dfa_rules);
+    view_lexer_t regex_lexer(regex_rules);
+    view_lexer_t static_lexer(static_rules);
+    view_lexer_t lazy_lexer(dfa_rules);
+    TokenArena arena;
+    SymbolTable symbols;
+    std::size_t values = 0;
+    auto pipeline = make_pipeline(
+        TypeFilter<BenchTokenType>({BenchTokenType::Punctuation}),
+        Interner<BenchTokenType>(symbols, {BenchTokenType::Identifier}),
+        NumberParser<BenchTokenType>({}, {BenchTokenType::Number}));
+
+    ParallelOptions parallel_options;
+    std::filesystem::path directory = make_run_directory();
+    TokenCache cache((directory / "cache").string());
+
+    if (directory.empty())
+    {
+        std::cerr << "Could not create a temporary directory" << std::endl;
+        return 1;
+    }
+
+    lazy_lexer.set_lazy_positions(true);
+    // Split even the default 256 KiB files into a chunk per worker
+    parallel_options.min_chunk_size = 16 << 10;
+
+    std::vector<Benchmark> benchmarks = {
+        {"tokenize", [&](const std::string& file)
+         { return lexer.tokenize(file).size(); }},
+        {"stream",
+         [&](const std::string& file)
+         {
+             std::size_t count = 0;
+
+             for (const auto& token : lexer.stream(file))
+             {
+                 (void)token;
+                 count++;
+             }
+
+             return count;
+         }},
+        {"stream_istream",
+         [&](const std::string& file)
+         {
+             std::istringstream input(file);
+             std::size_t count = 0;
+
+             for (const auto& token : lexer.stream(input))
+             {
+                 (void)token;
+                 count++;
+             }
+
+             return count;
+         }},
+        {"tokenize_view", [&](const std::string& file)
+         { return view_lexer.tokenize_view(file).size(); }},
+        {"stream_view",
+         [&](const std::string& file)
+         {
+             std::size_t count = 0;
+
+             for (const auto& token : view_lexer.stream_view(file))
+             {
+                 (void)token;
+                 count++;
+             }
+
+             return count;
+         }},
+        {"next_batch",
+         [&](const std::string& file)
+         {
+             std::vector<TokenView<BenchTokenType>> batch(256);
+             std::size_t count = 0;
+
+             view_lexer.stream_view(file);
+
+             while (std::size_t n =
+                        view_lexer.next_batch(batch.data(), batch.size()))
+                 count += n;
+
+             return count;
+         }},
+        {"tokenize_buffer", [&](const std::string& file)
+         { return view_lexer.tokenize_buffer(file).size(); }},
+        {"tokenize_arena",
+         [&](const std::string& file)
+         {
+             arena.reset();
+             return view_lexer.tokenize_arena(file, arena).size();
+         }},
+        {"tokenize_into",
+         [&](const std::string& file)
+         {
+             symbols.clear();
+
+             return view_lexer.tokenize_into(
+                 file, pipeline,
+                 [&](ValuedToken<BenchTokenType, std::string_view>&& token)
+                 { values += token.value.index() != 0; });
+         }},
+        {"tokenize_parallel",
+         [&](const std::string& file)
+         {
+             return tokenize_parallel<BenchTokenType, std::string_view>(
+                        dfa_rules, file, parallel_options)
+                 .size();
+         }},
+        {"tokenize_file",
+         {},
+         0,
+         [&](const std::string& path)
+         { return view_lexer.tokenize_file(path.c_str()).size(); }},
+        // The first repetition fills the cache and every later one loads
+        // from it, so the fastest repetition is the time of a cache hit.
+        {"tokenize_file_cache",
+         {},
+         0,
+         [&](const std::string& path)
+         { return view_lexer.tokenize_file(path.c_str(), cache).size(); }},
+        {"tokenize_files",
+         {},
+         0,
+         {},
+         [&](const std::vector<std::string>& paths)
+         {
+             std::size_t count = 0;
+
+             for (const auto& tokens :
+                  tokenize_files<BenchTokenType>(dfa_rules, paths))
+                 count += tokens.size();
+
+             return count;
+         }},
+        {"lazy_tokenize_view", [&](const std::string& file)
+         { return lazy_lexer.tokenize_view(file).size(); }},
+        {"static_tokenize_view", [&](const std::string& file)
+         { return static_lexer.tokenize_view(file).size(); }},
+        {"regex_tokenize_view",
+         [&](const std::string& file)
+         { return regex_lexer.tokenize_view(file).size(); },
+         options.regex_size},
+    };
+
+    std::vector<std::function<Corpus(const BenchOptions&)>> corpora = {
+        cpp_corpus, json_corpus, whitespace_corpus, long_identifier_corpus};
+
+    std::vector<BenchResult> results;
+
+    for (const auto& make_corpus : corpora)
+    {
+        Corpus corpus = make_corpus(options);
+        std::vector<const Benchmark*> selected;
+        bool reads_files = false;
+
+        for (const auto& benchmark : benchmarks)
+        {
+            if (!options.filter.empty() &&
+                corpus.name.find(options.filter) == std::string::npos &&
+                benchmark.name.find(options.filter) == std::string::npos)
+                continue;
+
+            selected.push_back(&benchmark);
+            reads_files = reads_files || benchmark.reads_files();
+        }
+
+        if (reads_files)
+        {
+            std::error_code error;
+            std::filesystem::create_directories(directory / "cache", error);
+
+            if (!write_files(corpus, directory))
+            {
+                std::filesystem::remove_all(directory, error);
+                return 1;
+            }
+        }
+
+        for (const Benchmark* benchmark : selected)
+        {
+            std::cerr << corpus.name << " / " << benchmark->name << std::endl;
+            results.push_back(run(corpus, *benchmark, options));
+        }
+
+        if (reads_files)
+        {
+            std::error_code error;
+            std::filesystem::remove_all(directory / "cache", error);
+
+            for (const auto& path : corpus.paths)
+                std::filesystem::remove(path, error);
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+
+    if (options.output.empty())
+        write_json(std::cout, options, results);
+    else
+    {
+        std::ofstream out(options.output);
+        write_json(out, options, results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "token.hpp"
+
+/**
+ * @brief A bump allocator for the tokens of many short-lived inputs.
+ *
+ * Allocations are carved out of large blocks and never freed one by one;
+ * reset() reclaims all of them at once and keeps the memory for the next
+ * input. After a reset that found more than one block in use, the blocks are
+ * merged into a single one of their total size, so that an arena reused for
+ * inputs of similar size settles on one block and stops allocating.
+ *
+ * An arena is not thread-safe. Give every thread its own arena; since the
+ * arena does not touch the heap in the steady state, threads then never
+ * contend on the allocator.
+ */
+class TokenArena
+{
+  public:
+    /// @brief The size of the first block.
+    static constexpr std::size_t default_block_size = 64 * 1024;
+
+    /**
+     * @brief Constructs an arena without allocating anything yet.
+     *
+     * @param block_size The size of the first block; later blocks double.
+     */
+    explicit TokenArena(std::size_t block_size = default_block_size)
+        : m_block_size(std::max<std::size_t>(block_size, 64))
+        , m_current(0)
+        , m_cursor(nullptr)
+        , m_end(nullptr)
+    {}
+
+    TokenArena(const TokenArena&) = delete;
+    TokenArena& operator=(const TokenArena&) = delete;
+
+    TokenArena(TokenArena&& other) noexcept
+        : TokenArena()
+    {
+        swap(other);
+    }
+
+    TokenArena& operator=(TokenArena&& other) noexcept
+    {
+        if (this != &other)
+        {
+            TokenArena released;
+            swap(other);
+            other.swap(released);
+        }
+
+        return *this;
+    }
+
+    /**
+     * @brief Allocates uninitialized memory.
+     *
+     * @param size The number of bytes.
+     * @param alignment The alignment, a power of two.
+     * @return The memory, valid until the next reset() or the destruction of
+     * the arena.
+     */
+    void* allocate(std::size_t size,
+                   std::size_t alignment = alignof(std::max_align_t))
+    {
+        char* at = align(m_cursor, alignment);
+
+        while (!at || at + size > m_end)
+        {
+            next_block(size + alignment);
+            at = align(m_cursor, alignment);
+        }
+
+        m_cursor = at + size;
+        return at;
+    }
+
+    /**
+     * @brief Gives memory back to the arena, which only reclaims it if it was
+     * the most recent allocation.
+     *
+     * @param data The memory, as returned by allocate().
+     * @param size The number of bytes it was allocated with.
+     */
+    void deallocate(void* data, std::size_t size)
+    {
+        if (static_cast<char*>(data) + size == m_cursor)
+            m_cursor = static_cast<char*>(data);
+    }
+
+    /**
+     * @brief Copies a text into the arena.
+     *
+     * @param text The text.
+     * @return A view of the copy.
+     */
+    std::string_view copy(std::string_view text)
+    {
+        if (text.empty())
+            return {};
+
+        char* data = static_cast<char*>(allocate(text.size(), 1));
+        std::memcpy(data, text.data(), text.size());
+
+        return {data, text.size()};
+    }
+
+    /**
+     * @brief Reclaims every allocation, keeping the memory for reuse.
+     */
+    void reset()
+    {
+        if (m_blocks.size() > 1)
+        {
+            std::size_t total = 0;
+
+            for (const auto& block : m_blocks)
+                total += block.size;
+
+            m_blocks.clear();
+            m_blocks.push_back(
+                {std::unique_ptr<char[]>(new char[total]), total});
+        }
+
+        m_current = 0;
+
+        if (m_blocks.empty())
+        {
+            m_cursor = m_end = nullptr;
+            return;
+        }
+
+        m_cursor = m_blocks[0].data.get();
+        m_end = m_cursor + m_blocks[0].size;
+    }
+
+    /// @brief The number of bytes handed out since the last reset, including
+    /// alignment padding and the unused ends of full blocks.
+    std::size_t used() const
+    {
+        std::size_t used = m_cursor ? m_cursor - m_blocks[m_current].data.get()
+                                    : 0;
+
+        for (std::size_t i = 0; i < m_current; i++)
+            used += m_blocks[i].size;
+
+        return used;
+    }
+
+    /// @brief The number of bytes the arena holds.
+    std::size_t capacity() const
+    {
+        std::size_t capacity = 0;
+
+        for (const auto& block : m_blocks)
+            capacity += block.size;
+
+        return capacity;
+    }
+
+  private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+    };
+
+    std::vector<Block> m_blocks;
+    /// @brief The size of the next block to allocate.
+    std::size_t m_block_size;
+    /// @brief The index of the block allocations are taken from.
+    std::size_t m_current;
+    char* m_cursor;
+    char* m_end;
+
+    static char* align(char* at, std::size_t alignment)
+    {
+        if (!at)
+            return nullptr;
+
+        auto address = reinterpret_cast<std::uintptr_t>(at);
+        auto aligned = (address + alignment - 1) & ~(alignment - 1);
+
+        return at + (aligned - address);
+    }
+
+    /**
+     * @brief Moves on to the next block that has room for a number of bytes,
+     * allocating one if there is none.
+     */
+    void next_block(std::size_t size)
+    {
+        std::size_t next = m_cursor ? m_current + 1 : 0;
+
+        while (next < m_blocks.size() && m_blocks[next].size < size)
+            next++;
+
+        if (next == m_blocks.size())
+        {
+            std::size_t block_size = std::max(m_block_size, size);
+            m_blocks.push_back(
+                {std::unique_ptr<char[]>(new char[block_size]), block_size});
+            m_block_size = block_size * 2;
+        }
+
+        // Blocks skipped over stay unused until the next reset.
+        m_current = next;
+        m_cursor = m_blocks[next].data.get();
+        m_end = m_cursor + m_blocks[next].size;
+    }
+
+    void swap(TokenArena& other) noexcept
+    {
+        std::swap(m_blocks, other.m_blocks);
+        std::swap(m_block_size, other.m_block_size);
+        std::swap(m_current, other.m_current);
+        std::swap(m_cursor, other.m_cursor);
+        std::swap(m_end, other.m_end);
+    }
+};
+
+/**
+ * @brief A standard allocator that takes its memory from a TokenArena, for
+ * containers that live no longer than the arena's next reset().
+ *
+ * @tparam T The type of the elements.
+ */
+template <typename T>
+class ArenaAllocator
+{
+  public:
+    using value_type = T;
+
+    ArenaAllocator(TokenArena& arena) noexcept
+        : m_arena(&arena)
+    {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+        : m_arena(other.arena())
+    {}
+
+    T* allocate(std::size_t count)
+    {
+        return static_cast<T*>(
+            m_arena->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* data, std::size_t count) noexcept
+    {
+        m_arena->deallocate(data, count * sizeof(T));
+    }
+
+    /// @brief The arena the memory is taken from.
+    TokenArena* arena() const { return m_arena; }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const
+    {
+        return m_arena == other.arena();
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const
+    {
+        return m_arena != other.arena();
+    }
+
+  private:
+    TokenArena* m_arena;
+};
+
+/**
+ * @brief Tokens whose records and lexemes live in a TokenArena.
+ *
+ * Both stay valid until the arena is reset or destroyed; the vector itself
+ * must not be used past that point either.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ */
+template <typename TokenType>
+using ArenaTokens =
+    std::vector<TokenView<TokenType>, ArenaAllocator<TokenView<TokenType>>>;
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lexer.hpp"
+#include "rule_set.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * @brief Tokenizes many files in parallel, handing each file's tokens to a
+ * sink.
+ *
+ * Files are scheduled on a WorkStealingPool, and every worker scans with its
+ * own Lexer over the shared rule set. The sink is called from the worker
+ * threads, once per file and in no particular order, so it must be safe to
+ * call concurrently. The tokens passed to it are only valid during the call;
+ * with view lexemes they point into the mapped file.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ * @tparam Lexeme The type holding the text of each token.
+ * @param rules The rule set to scan with.
+ * @param paths The files to tokenize.
+ * @param threads The number of worker threads; 0 uses one per hardware thread.
+ * @param sink Called as sink(index, tokens) with the index of the file in
+ * paths and a mutable vector of its tokens.
+ */
+template <typename TokenType, typename Lexeme = std::string, typename Sink>
+void tokenize_files(const std::shared_ptr<const RuleSet<TokenType>>& rules,
+                    const std::vector<std::string>& paths,
+                    std::size_t threads,
+                    Sink&& sink)
+{
+    WorkStealingPool pool(threads);
+    std::vector<Lexer<TokenType, Lexeme>> lexers(
+        pool.size(), Lexer<TokenType, Lexeme>(rules));
+
+    for (std::size_t index = 0; index < paths.size(); index++)
+    {
+        pool.submit(
+            [&, index](std::size_t worker)
+            {
+                auto tokens = lexers[worker].tokenize_file(
+                    paths[index].c_str());
+
+                sink(index, tokens);
+            });
+    }
+
+    pool.wait();
+}
+
+/**
+ * @brief Tokenizes many files in parallel.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ * @param rules The rule set to scan with.
+ * @param paths The files to tokenize.
+ * @param threads The number of worker threads; 0 uses one per hardware thread.
+ * @return The tokens of every file, in the order of paths.
+ */
+template <typename TokenType>
+std::vector<std::vector<Token<TokenType>>>
+tokenize_files(const std::shared_ptr<const RuleSet<TokenType>>& rules,
+               const std::vector<std::string>& paths,
+               std::size_t threads = 0)
+{
+    std::vector<std::vector<Token<TokenType>>> results(paths.size());
+
+    tokenize_files<TokenType>(
+        rules, paths, threads,
+        [&results](std::size_t index, std::vector<Token<TokenType>>& tokens)
+        { results[index] = std::move(tokens); });
+
+    return results;
+}
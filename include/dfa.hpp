@@ -0,0 +1,519 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pattern.hpp"
+#include "simd.hpp"
+
+/**
+ * @brief A deterministic finite automaton that recognizes a whole set of token
+ * patterns at once.
+ *
+ * All patterns are compiled into a single automaton, so that the longest match
+ * over every pattern is found by reading each input byte once. When several
+ * patterns match the same longest prefix, the one listed first wins, mirroring
+ * the rule order of the lexer's definitions.
+ *
+ * Bytes that no pattern distinguishes are folded into equivalence classes to
+ * keep the transition table small. States that loop on themselves over a
+ * simple byte set, like those inside whitespace, number or identifier runs,
+ * skip the whole run with skip_bytes() instead of one transition per byte.
+ * Literal tokens need no special casing: the transitions out of the start
+ * state already dispatch on their first byte like a trie.
+ *
+ * The transition and accept tables are immutable once built and shared
+ * between copies. They may also be borrowed from a serialized image, such as
+ * a mapped file (see deserialize()), in which case nothing is compiled.
+ */
+class Dfa
+{
+  public:
+    /// @brief Marks a state, or a match, that accepts no pattern.
+    static constexpr std::uint32_t no_rule = UINT32_MAX;
+    /// @brief The state every transition leads to once no pattern can match.
+    static constexpr std::uint32_t dead_state = 0;
+
+    /**
+     * @brief The result of matching the automaton against a prefix of the
+     * input.
+     */
+    struct Match
+    {
+        /// @brief The length of the longest matching prefix.
+        std::size_t length;
+        /// @brief The index of the pattern that matched, or no_rule.
+        std::uint32_t rule;
+        /// @brief Whether the input ended while a longer match was still
+        /// possible, so that more input could change the result.
+        bool hit_end = false;
+        /// @brief The number of bytes read to find the match, plus one if the
+        /// end of the input was reached. The result only depends on these
+        /// bytes.
+        std::size_t scanned = 0;
+    };
+
+    /**
+     * @brief Constructs an automaton that matches nothing.
+     */
+    Dfa()
+        : m_classes{}
+        , m_class_count(1)
+        , m_start(dead_state)
+        , m_state_count(1)
+        , m_transitions(&empty_table[0])
+        , m_accept(&empty_table[1])
+        , m_runs(1, no_run)
+    {}
+
+    /**
+     * @brief Compiles a set of patterns into a single automaton.
+     *
+     * Patterns that use syntax the compiler does not support are left out of
+     * the automaton; use compiled() to find out which ones they are.
+     *
+     * @param patterns The ECMAScript patterns, in priority order.
+     * @return The compiled automaton.
+     */
+    static Dfa compile(const std::vector<std::string>& patterns);
+
+    /**
+     * @brief Appends the tables of the automaton to a buffer, in the format
+     * read by deserialize().
+     *
+     * The integers are stored in the byte order of the host, and every table
+     * starts at a multiple of four bytes from the start of the automaton.
+     *
+     * @param out The buffer to append to.
+     */
+    void serialize(std::string& out) const;
+
+    /**
+     * @brief Reads an automaton written by serialize(), without copying its
+     * tables.
+     *
+     * @param data The serialized automaton. It must be aligned to four bytes.
+     * @param owner Keeps the memory of data alive for as long as the
+     * automaton or a copy of it exists; may be null if data is static.
+     * @return The automaton, or std::nullopt if data is truncated, misaligned
+     * or inconsistent.
+     */
+    static std::optional<Dfa> deserialize(std::string_view data,
+                                          std::shared_ptr<const void> owner);
+
+    /**
+     * @brief Finds the longest prefix of [begin, end) matched by any pattern.
+     *
+     * Empty matches are never reported.
+     *
+     * @param begin The start of the input.
+     * @param end The end of the input.
+     * @return The length and the pattern index of the match, or a zero length
+     * and no_rule if no pattern matches.
+     */
+    Match match(const char* begin, const char* end) const
+    {
+        Match best = {0, no_rule};
+        std::uint32_t state = m_start;
+        const char* it = begin;
+
+        while (it != end && state != dead_state)
+        {
+            state = m_transitions[state * m_class_count +
+                                  m_classes[static_cast<unsigned char>(*it)]];
+            ++it;
+
+            if (m_runs[state] != no_run)
+                it = skip_bytes(m_run_sets[m_runs[state]], it, end);
+
+            if (m_accept[state] != no_rule)
+                best = {static_cast<std::size_t>(it - begin),
+                        m_accept[state]};
+        }
+
+        best.hit_end = state != dead_state;
+        best.scanned = static_cast<std::size_t>(it - begin) + best.hit_end;
+
+        return best;
+    }
+
+    /**
+     * @brief Tells whether the given pattern is part of the automaton.
+     *
+     * @param rule The index of the pattern passed to compile().
+     */
+    bool compiled(std::size_t rule) const
+    {
+        return rule < m_compiled.size() && m_compiled[rule];
+    }
+
+    /// @brief The number of patterns passed to compile().
+    std::size_t pattern_count() const { return m_compiled.size(); }
+
+    /// @brief The number of states, including the dead state.
+    std::size_t state_count() const { return m_state_count; }
+
+    /**
+     * @brief Splits the bytes into classes that every transition of an NFA
+     * treats alike.
+     *
+     * @param nfa The NFA, as built by NfaBuilder.
+     * @param classes Receives the class of every byte.
+     * @return The number of classes.
+     */
+    template <typename Nfa>
+    static constexpr std::size_t byte_classes(const Nfa& nfa,
+                                              std::uint8_t (&classes)[256]);
+
+    /**
+     * @brief Finds the bytes a state loops on, when they are worth skipping
+     * with skip_bytes().
+     *
+     * @param row The transitions out of the state, indexed by byte class.
+     * @param classes The class of every byte.
+     * @param state The state.
+     * @param set Receives the bytes that lead back to the state.
+     * @return Whether the bytes form a run set.
+     */
+    template <typename Transition>
+    static constexpr bool find_run(const Transition* row,
+                                   const std::uint8_t (&classes)[256],
+                                   std::uint32_t state,
+                                   ByteRanges& set);
+
+  private:
+    /// @brief Marks a state without a byte run to skip.
+    static constexpr std::uint32_t no_run = UINT32_MAX;
+    /// @brief The tables of the automaton that matches nothing: the dead
+    /// state's only transition, then its accepted rule.
+    static constexpr std::uint32_t empty_table[2] = {dead_state, no_rule};
+
+    /**
+     * @brief The tables built by compile().
+     */
+    struct Tables
+    {
+        std::vector<std::uint32_t> transitions;
+        std::vector<std::uint32_t> accept;
+    };
+
+    /// @brief Maps every byte to its equivalence class.
+    std::uint8_t m_classes[256];
+    std::size_t m_class_count;
+    std::uint32_t m_start;
+    std::size_t m_state_count;
+    /// @brief Keeps the memory m_transitions and m_accept point to alive.
+    std::shared_ptr<const void> m_storage;
+    /// @brief Row-major transition table indexed by state and byte class.
+    const std::uint32_t* m_transitions;
+    /// @brief The pattern accepted by each state, or no_rule.
+    const std::uint32_t* m_accept;
+    std::vector<bool> m_compiled;
+    /// @brief The index into m_run_sets of the bytes each state loops on, or
+    /// no_run.
+    std::vector<std::uint32_t> m_runs;
+    /// @brief The distinct byte sets states loop on.
+    std::vector<ByteRanges> m_run_sets;
+
+    static void closure(const VectorNfa& nfa,
+                        std::vector<std::uint32_t>& states);
+
+    /**
+     * @brief Finds the states worth skipping runs of bytes in, once the
+     * tables are in place.
+     */
+    void find_runs();
+};
+
+inline void Dfa::closure(const VectorNfa& nfa,
+                         std::vector<std::uint32_t>& states)
+{
+    std::vector<bool> seen(nfa.size(), false);
+    std::vector<std::uint32_t> pending(states);
+
+    for (auto state : states)
+        seen[state] = true;
+
+    while (!pending.empty())
+    {
+        std::uint32_t state = pending.back();
+        pending.pop_back();
+
+        for (auto next : nfa[state].epsilon)
+        {
+            if (next == NfaState::none || seen[next])
+                continue;
+
+            seen[next] = true;
+            states.push_back(next);
+            pending.push_back(next);
+        }
+    }
+
+    std::sort(states.begin(), states.end());
+    states.erase(std::unique(states.begin(), states.end()), states.end());
+}
+
+template <typename Nfa>
+constexpr std::size_t Dfa::byte_classes(const Nfa& nfa,
+                                        std::uint8_t (&classes)[256])
+{
+    std::size_t class_count = 1;
+
+    for (unsigned c = 0; c < 256; c++)
+        classes[c] = 0;
+
+    for (std::size_t state = 0; state < nfa.size(); state++)
+    {
+        if (nfa[state].next == NfaState::none)
+            continue;
+
+        // Split every class by membership in the state's set.
+        int refined[512] = {};
+        int count = 0;
+
+        for (int& id : refined)
+            id = -1;
+
+        for (unsigned c = 0; c < 256; c++)
+        {
+            int key = classes[c] * 2 + nfa[state].set.test(c);
+
+            if (refined[key] < 0)
+                refined[key] = count++;
+
+            classes[c] = static_cast<std::uint8_t>(refined[key]);
+        }
+
+        class_count = count;
+    }
+
+    return class_count;
+}
+
+template <typename Transition>
+constexpr bool Dfa::find_run(const Transition* row,
+                             const std::uint8_t (&classes)[256],
+                             std::uint32_t state,
+                             ByteRanges& set)
+{
+    unsigned members = 0;
+
+    set = ByteRanges{};
+
+    for (unsigned c = 0; c < 256; c++)
+    {
+        if (row[classes[c]] != state)
+            continue;
+
+        set.table[c] = true;
+        members++;
+
+        if (c > 0 && set.table[c - 1])
+        {
+            set.span[set.count - 1]++;
+            continue;
+        }
+
+        if (set.count == ByteRanges::max_ranges)
+            return false;
+
+        set.lo[set.count] = static_cast<std::uint8_t>(c);
+        set.span[set.count] = 0;
+        set.count++;
+    }
+
+    // Single bytes are cheaper to follow through the table.
+    return members >= 2;
+}
+
+inline Dfa Dfa::compile(const std::vector<std::string>& patterns)
+{
+    Dfa dfa;
+    VectorNfa nfa;
+    NfaBuilder<VectorNfa> builder(nfa);
+
+    dfa.m_compiled.assign(patterns.size(), false);
+
+    for (std::size_t rule = 0; rule < patterns.size(); rule++)
+        dfa.m_compiled[rule] =
+            builder.add_pattern(patterns[rule].data(), patterns[rule].size(),
+                                static_cast<std::uint32_t>(rule));
+
+    std::uint8_t classes[256] = {};
+    std::size_t class_count = byte_classes(nfa, classes);
+    std::vector<unsigned char> representatives(class_count);
+
+    for (unsigned c = 256; c-- > 0;)
+        representatives[classes[c]] = static_cast<unsigned char>(c);
+
+    // Subset construction; the empty set of NFA states is the dead state.
+    std::map<std::vector<std::uint32_t>, std::uint32_t> ids;
+    std::vector<std::vector<std::uint32_t>> sets;
+
+    auto intern = [&](std::vector<std::uint32_t> set)
+    {
+        auto it = ids.find(set);
+
+        if (it != ids.end())
+            return it->second;
+
+        auto id = static_cast<std::uint32_t>(sets.size());
+        ids.emplace(set, id);
+        sets.push_back(std::move(set));
+        return id;
+    };
+
+    intern({});
+
+    std::vector<std::uint32_t> initial = {builder.start()};
+    closure(nfa, initial);
+    dfa.m_start = intern(initial);
+
+    std::vector<std::uint32_t> transitions;
+    std::vector<std::uint32_t> accept;
+
+    for (std::size_t id = 0; id < sets.size(); id++)
+    {
+        std::uint32_t rule = no_rule;
+
+        for (auto state : sets[id])
+            rule = std::min(rule, nfa[state].rule);
+
+        accept.push_back(rule);
+
+        for (std::size_t cls = 0; cls < class_count; cls++)
+        {
+            std::vector<std::uint32_t> next;
+
+            for (auto state : sets[id])
+                if (nfa[state].next != NfaState::none &&
+                    nfa[state].set.test(representatives[cls]))
+                    next.push_back(nfa[state].next);
+
+            closure(nfa, next);
+            transitions.push_back(intern(std::move(next)));
+        }
+    }
+
+    auto tables = std::make_shared<Tables>();
+    tables->transitions = std::move(transitions);
+    tables->accept = std::move(accept);
+
+    std::copy(std::begin(classes), std::end(classes), dfa.m_classes);
+    dfa.m_class_count = class_count;
+    dfa.m_state_count = tables->accept.size();
+    dfa.m_transitions = tables->transitions.data();
+    dfa.m_accept = tables->accept.data();
+    dfa.m_storage = std::move(tables);
+    dfa.find_runs();
+
+    return dfa;
+}
+
+inline void Dfa::find_runs()
+{
+    m_runs.assign(m_state_count, no_run);
+    m_run_sets.clear();
+
+    for (std::uint32_t state = 1; state < m_state_count; state++)
+    {
+        ByteRanges set;
+
+        if (!find_run(&m_transitions[state * m_class_count], m_classes, state,
+                      set))
+            continue;
+
+        m_runs[state] = static_cast<std::uint32_t>(m_run_sets.size());
+        m_run_sets.push_back(set);
+    }
+}
+
+// The serialized form is four 32-bit counts (classes, states, start state and
+// patterns), the 256 byte classes, one byte per pattern telling whether it was
+// compiled, padding to a multiple of four, the transition table and the
+// accept table. The run sets are derived from the transitions again on load,
+// which keeps the format independent of the SIMD kernels.
+inline void Dfa::serialize(std::string& out) const
+{
+    auto put = [&](const void* data, std::size_t size)
+    { out.append(static_cast<const char*>(data), size); };
+
+    std::uint32_t header[4] = {
+        static_cast<std::uint32_t>(m_class_count),
+        static_cast<std::uint32_t>(m_state_count),
+        m_start,
+        static_cast<std::uint32_t>(m_compiled.size()),
+    };
+
+    put(header, sizeof(header));
+    put(m_classes, sizeof(m_classes));
+
+    for (bool compiled : m_compiled)
+        out.push_back(compiled ? 1 : 0);
+
+    out.append((4 - m_compiled.size() % 4) % 4, '\0');
+    put(m_transitions, m_state_count * m_class_count * sizeof(std::uint32_t));
+    put(m_accept, m_state_count * sizeof(std::uint32_t));
+}
+
+inline std::optional<Dfa> Dfa::deserialize(std::string_view data,
+                                           std::shared_ptr<const void> owner)
+{
+    std::uint32_t header[4];
+
+    if (reinterpret_cast<std::uintptr_t>(data.data()) % 4 != 0 ||
+        data.size() < sizeof(header) + 256)
+        return std::nullopt;
+
+    std::memcpy(header, data.data(), sizeof(header));
+
+    auto [class_count, state_count, start, patterns] = header;
+    std::size_t flags = sizeof(header) + 256;
+    std::size_t transitions = flags + (patterns + 3) / 4 * 4;
+    std::size_t accept =
+        transitions + std::size_t(state_count) * class_count * 4;
+
+    if (class_count == 0 || class_count > 256 || state_count == 0 ||
+        start >= state_count || data.size() != accept + state_count * 4)
+        return std::nullopt;
+
+    Dfa dfa;
+    std::memcpy(dfa.m_classes, data.data() + sizeof(header), 256);
+    dfa.m_class_count = class_count;
+    dfa.m_state_count = state_count;
+    dfa.m_start = start;
+    dfa.m_transitions =
+        reinterpret_cast<const std::uint32_t*>(data.data() + transitions);
+    dfa.m_accept = reinterpret_cast<const std::uint32_t*>(data.data() + accept);
+    dfa.m_storage = std::move(owner);
+    dfa.m_compiled.resize(patterns);
+
+    for (std::size_t rule = 0; rule < patterns; rule++)
+        dfa.m_compiled[rule] = data[flags + rule] != 0;
+
+    // A corrupt table must not send match() out of bounds.
+    for (unsigned c = 0; c < 256; c++)
+        if (dfa.m_classes[c] >= class_count)
+            return std::nullopt;
+
+    for (std::size_t i = 0; i < std::size_t(state_count) * class_count; i++)
+        if (dfa.m_transitions[i] >= state_count)
+            return std::nullopt;
+
+    for (std::size_t state = 0; state < state_count; state++)
+        if (dfa.m_accept[state] != no_rule && dfa.m_accept[state] >= patterns)
+            return std::nullopt;
+
+    dfa.find_runs();
+
+    return dfa;
+}
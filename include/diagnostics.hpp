@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "line_index.hpp"
+
+/**
+ * @brief What the lexer does at a position where no definition matches.
+ */
+enum class ErrorRecovery
+{
+    /// @brief Ends the scan at the error.
+    Abort,
+    /// @brief Skips the bytes up to the next position where a definition
+    /// matches, and carries on from there.
+    SkipByte,
+    /// @brief Skips the bytes up to the next position where a token of one of
+    /// the sync types matches, and carries on from there.
+    SkipToSync,
+    /// @brief Turns the bytes up to the next position where a definition
+    /// matches into a token of the error type.
+    EmitError,
+};
+
+/**
+ * @brief Options controlling how a Lexer handles lexical errors.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ */
+template <typename TokenType>
+struct ErrorOptions
+{
+    ErrorRecovery recovery = ErrorRecovery::Abort;
+    /// @brief The token types ErrorRecovery::SkipToSync resumes at. Without
+    /// any, it resumes at the next position where a definition matches.
+    std::vector<TokenType> sync = {};
+    /// @brief The type of the tokens made by ErrorRecovery::EmitError.
+    TokenType error_type = {};
+    /// @brief Also print every error to std::cerr as soon as it is found.
+    bool print = true;
+};
+
+/**
+ * @brief A lexical error: a run of the input no definition matched.
+ */
+struct Diagnostic
+{
+    /// @brief The offset of the first unmatched byte in the input.
+    std::size_t offset;
+    /// @brief The number of bytes skipped, or 0 if the scan was aborted.
+    std::size_t length;
+    /// @brief The line number of the first unmatched byte.
+    std::size_t line;
+    /// @brief The column number of the first unmatched byte.
+    std::size_t column;
+};
+
+/**
+ * @brief The lexical errors found in one input.
+ */
+struct Diagnostics
+{
+    /// @brief The errors, in input order.
+    std::vector<Diagnostic> errors;
+    /// @brief Whether the scan stopped at the last error.
+    bool aborted = false;
+
+    /// @brief Whether no error was found.
+    bool empty() const { return errors.empty(); }
+
+    /**
+     * @brief Prints every error, with the line it is on and a caret under it.
+     *
+     * @param out The stream to print to.
+     * @param source The input the errors were found in.
+     */
+    void print(std::ostream& out, std::string_view source) const
+    {
+        LineIndex lines(source);
+
+        for (const auto& error : errors)
+            print(out, error, lines.text(error.line));
+    }
+
+    /**
+     * @brief Prints one error.
+     *
+     * The line may be a part of the line the error is on, as when only a
+     * window of a streamed input is at hand; the missing parts are marked
+     * with "...".
+     *
+     * @param out The stream to print to.
+     * @param error The error.
+     * @param line The text of the line the error is on, or the part of it
+     * around the error.
+     * @param first_column The column of the first byte of line.
+     * @param cut Whether the line continues past the end of line.
+     */
+    static void print(std::ostream& out,
+                      const Diagnostic& error,
+                      std::string_view line,
+                      std::size_t first_column = 1,
+                      bool cut = false)
+    {
+        std::size_t indent = first_column > 1 ? 3 : 0;
+
+        out << (first_column > 1 ? "..." : "") << line << (cut ? "..." : "")
+            << std::endl;
+        out << std::string(indent + error.column - first_column, ' ') << "^"
+            << std::endl;
+        out << "Unexpected token at line " << error.line << " and column "
+            << error.column << std::endl;
+    }
+
+    void clear()
+    {
+        errors.clear();
+        aborted = false;
+    }
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// @brief The offset basis of 64-bit FNV-1a, the hash of no bytes.
+inline constexpr std::uint64_t fnv1a_basis = 0xcbf29ce484222325;
+
+/**
+ * @brief Hashes bytes with 64-bit FNV-1a, continuing from a previous hash so
+ * that several fields can be mixed into one digest.
+ *
+ * @param data The bytes.
+ * @param size The number of bytes.
+ * @param seed The hash of the bytes mixed in before, or fnv1a_basis.
+ * @return The hash of the bytes following those hashed into seed.
+ */
+inline std::uint64_t
+fnv1a(const void* data, std::size_t size, std::uint64_t seed = fnv1a_basis)
+{
+    const auto* bytes = static_cast<const unsigned char*>(data);
+
+    for (std::size_t i = 0; i < size; i++)
+    {
+        seed ^= bytes[i];
+        seed *= 0x100000001b3;
+    }
+
+    return seed;
+}
@@ -1,13 +1,27 @@
+#pragma once
+
+#include <algorithm>
 #include <cstddef>
-#include <fstream>
+#include <cstring>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <optional>
-#include <regex>
-#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
+#include "arena.hpp"
+#include "diagnostics.hpp"
+#include "line_index.hpp"
+#include "mapped_file.hpp"
+#include "pipeline.hpp"
+#include "profiler.hpp"
+#include "rule_set.hpp"
 #include "token.hpp"
+#include "token_buffer.hpp"
+#include "token_cache.hpp"
 
 /**
  * @brief A generic, regular-expression-based lexical analyzer.
@@ -16,12 +30,59 @@
  * set of provided token definitions. It supports both eager tokenization into a
  * vector and lazy, stream-based tokenization via iterators.
  *
+ * At every position the longest match wins, and among equally long matches the
+ * definition listed first wins. Only the definitions of the current mode take
+ * part; the lexer keeps a stack of modes, which starts out holding mode 0 and
+ * is pushed and popped by the mode actions of the definitions that match.
+ *
+ * Every token carries the offset of its lexeme. Its line and column are
+ * either counted during the scan, as the position just past the token, or,
+ * with set_lazy_positions(), left at 0 and resolved on demand by position(),
+ * as the position where the token starts.
+ *
+ * Where no definition matches, the lexer reports the error and, depending on
+ * its ErrorOptions, ends the scan or recovers by skipping or emitting the
+ * unmatched bytes. Every error of the current input is collected in
+ * diagnostics().
+ *
+ * The compiled definitions live in a RuleSet that may be shared; the lexer
+ * itself only holds the state of the current scan, so each thread needs its
+ * own Lexer but all of them can use the same RuleSet. Lexers can be copied and
+ * moved, along with the state of their current scan.
+ *
+ * The lexeme type decides who owns the text of a token. With the default
+ * std::string every token carries its own copy. With std::string_view (see
+ * TokenView) tokens point into the buffer the lexer scans and no memory is
+ * allocated per token; such tokens stay valid only as long as that buffer:
+ *  - for stream() and tokenize(), the lexer keeps its own copy of the input,
+ *    and for stream_from_file() and tokenize_file() it keeps the file mapped;
+ *    either lives until the next call that starts a new input or until the
+ *    lexer is destroyed;
+ *  - for stream_view() and tokenize_view(), the lexer scans the caller's
+ *    buffer in place, which must outlive every token produced from it;
+ *  - for stream() over a std::istream, the lexer only buffers a window of the
+ *    input; a view from next_batch() is valid until the next batch is pulled,
+ *    and one reached through a TokenStream until the iterator has moved
+ *    twice past it.
+ *
  * @tparam TokenType The enum type used for classifying tokens.
+ * @tparam Lexeme The type holding the text of each token, either std::string
+ * or std::string_view.
+ * @tparam Profiler The policy told about every match, such as RuleProfiler.
+ * The default NullProfiler records nothing and costs nothing.
  */
-template <typename TokenType>
+template <typename TokenType,
+          typename Lexeme = std::string,
+          typename Profiler = NullProfiler>
 class Lexer
 {
   public:
+    /// @brief The type of the tokens produced by this lexer.
+    using token_t = Token<TokenType, Lexeme>;
+
+    /// @brief The number of bytes read at once by stream() from a std::istream.
+    static constexpr std::size_t default_chunk_size = 64 * 1024;
+
     /**
      * @brief Constructs an empty, unconfigured lexer.
      */
@@ -32,26 +93,287 @@ class Lexer
      *
      * @param definitions A vector of TokenDefinition objects that define the
      * lexer's behavior.
+     * @param backend The matching engine to use. Defaults to the DFA.
+     */
+    Lexer(std::vector<TokenDefinition<TokenType>> definitions,
+          LexerBackend backend = LexerBackend::Dfa);
+
+    /**
+     * @brief Constructs a lexer that scans with an already compiled, possibly
+     * shared, rule set.
+     *
+     * @param rules The rule set to scan with.
+     */
+    Lexer(std::shared_ptr<const RuleSet<TokenType>> rules);
+
+    /**
+     * @brief Copies a lexer, including the state of its current scan.
+     *
+     * An input the lexer keeps its own copy of is copied too; a mapped file is
+     * shared between the copies, and a caller's buffer or std::istream is used
+     * by both.
      */
-    Lexer(std::vector<TokenDefinition<TokenType>> definitions);
+    Lexer(const Lexer& other)
+        : Lexer(other.m_rules)
+    {
+        assign(other);
+    }
+
+    Lexer(Lexer&& other) noexcept
+        : Lexer(other.m_rules)
+    {
+        assign(std::move(other));
+    }
+
+    Lexer& operator=(const Lexer& other)
+    {
+        if (this != &other)
+            assign(other);
+
+        return *this;
+    }
+
+    Lexer& operator=(Lexer&& other) noexcept
+    {
+        if (this != &other)
+            assign(std::move(other));
+
+        return *this;
+    }
+
     ~Lexer();
 
+    /// @brief The rule set the lexer scans with.
+    const std::shared_ptr<const RuleSet<TokenType>>& rules() const
+    {
+        return m_rules;
+    }
+
+    /// @brief How lexical errors are handled.
+    const ErrorOptions<TokenType>& error_options() const
+    {
+        return m_error_options;
+    }
+
+    /**
+     * @brief Sets how lexical errors are handled from the next token on.
+     *
+     * @param options The options.
+     */
+    void set_error_options(ErrorOptions<TokenType> options)
+    {
+        m_error_options = std::move(options);
+        m_error_definition.type = m_error_options.error_type;
+    }
+
+    /**
+     * @brief Chooses whether lines and columns are counted during the scan or
+     * resolved on demand.
+     *
+     * Lazily, the scan does no per-byte bookkeeping. Tokens have a line and
+     * column of 0, and position() resolves their offsets from an index of
+     * where the lines start, built with memchr as far as it is asked for.
+     * tokenize_buffer() and retokenize_buffer() always count.
+     *
+     * @param lazy Whether to resolve positions on demand. Takes effect with
+     * the next input.
+     */
+    void set_lazy_positions(bool lazy) { m_lazy_positions = lazy; }
+
+    /// @brief Whether positions are resolved on demand.
+    bool lazy_positions() const { return m_lazy_positions; }
+
+    /**
+     * @brief Resolves an offset in the current input to a line and column,
+     * by binary search over the start of every line.
+     *
+     * With lazy positions, a streamed input is indexed before every chunk is
+     * dropped, so offsets that are no longer buffered resolve too; the index
+     * then holds an offset for every line read so far, so its memory grows
+     * with the number of lines of the input rather than with the window.
+     * Otherwise a streamed input is not indexed, and once its first chunk is
+     * dropped position() no longer resolves its offsets correctly; its tokens
+     * carry their positions anyway.
+     *
+     * @param offset The offset, such as that of a token; resolving the offset
+     * of a token gives the position where it starts.
+     * @return The position, whose column counts bytes from 1.
+     */
+    SourcePosition position(std::size_t offset)
+    {
+        index_lines(offset);
+        return m_lines.position(offset);
+    }
+
+    /**
+     * @brief Pulls the next tokens of the current input into an array.
+     *
+     * Pulling many tokens per call pays the cost of a call, and of telling
+     * whether the input has ended, once per batch rather than once per token.
+     * Tokens already pulled into the ring buffer of a TokenStream come first.
+     *
+     * @param tokens The array to fill.
+     * @param capacity The size of the array.
+     * @return The number of tokens written, which is less than capacity only
+     * at the end of the input, and 0 past it.
+     */
+    std::size_t next_batch(token_t* tokens, std::size_t capacity)
+    {
+        std::size_t count = 0;
+
+        for (; count < capacity && m_ring_next != m_ring_end; count++)
+            tokens[count] = std::move(m_ring[m_ring_next++]);
+
+        return count + fill(tokens + count, capacity - count, nullptr);
+    }
+
+    /**
+     * @brief Pulls the next tokens of the current input into a callback.
+     *
+     * @param capacity The largest number of tokens to pull.
+     * @param sink Called with every token, as a token_t rvalue. A view lexeme
+     * is only guaranteed to be valid during the call.
+     * @return The number of tokens pulled, which is less than capacity only at
+     * the end of the input, and 0 past it.
+     */
+    template <typename Sink>
+    std::size_t next_batch(std::size_t capacity, Sink&& sink)
+    {
+        std::size_t count = 0;
+
+        for (; count < capacity && m_ring_next != m_ring_end; count++)
+            sink(std::move(m_ring[m_ring_next++]));
+
+        for (; count < capacity; count++)
+        {
+            auto scanned = scan();
+
+            if (!scanned)
+                break;
+
+            sink(make_token(*scanned));
+        }
+
+        return count;
+    }
+
+    /// @brief The number of tokens a TokenStream pulls at once.
+    static constexpr std::size_t stream_batch_size = 64;
+
+    /// @brief The lexical errors found in the current input so far.
+    const Diagnostics& diagnostics() const { return m_diagnostics; }
+
+    /// @brief The mode the lexer is in, at the top of its mode stack.
+    LexerMode mode() const { return m_modes.back(); }
+
+    /// @brief The profiling policy, holding whatever it recorded so far.
+    Profiler& profiler() { return m_profiler; }
+    const Profiler& profiler() const { return m_profiler; }
+
     /**
      * @brief Eagerly tokenizes the entire input string into a vector of tokens.
      *
      * @param input The string to tokenize.
      * @return A vector containing all identified tokens.
      */
-    std::vector<Token<TokenType>> tokenize(const std::string& input);
+    std::vector<token_t> tokenize(const std::string& input);
 
     /**
      * @brief Overload for C-style string literals.
      */
-    std::vector<Token<TokenType>> tokenize(const char* input)
+    std::vector<token_t> tokenize(const char* input)
     {
         return tokenize(std::string(input));
     }
 
+    /**
+     * @brief Eagerly tokenizes a buffer owned by the caller, without copying
+     * it.
+     *
+     * @param input The buffer to tokenize. It must outlive the returned tokens
+     * when they are views.
+     * @return A vector containing all identified tokens.
+     */
+    std::vector<token_t> tokenize_view(std::string_view input);
+
+    /**
+     * @brief Eagerly tokenizes a buffer into tokens allocated from an arena.
+     *
+     * The input is copied into the arena once, and the token records are
+     * allocated from it too, with lexemes pointing into the copy. A caller
+     * that tokenizes many inputs in a loop and resets the arena in between
+     * therefore does no heap allocation per input once the arena has grown
+     * to the size of the largest one.
+     *
+     * @param input The buffer to tokenize; it may be discarded afterwards.
+     * @param arena The arena to allocate from. The tokens are valid until it
+     * is reset.
+     * @return The tokens of the input.
+     */
+    ArenaTokens<TokenType> tokenize_arena(std::string_view input,
+                                          TokenArena& arena);
+
+    /**
+     * @brief Tokenizes a buffer and runs every token through a pipeline as
+     * soon as it is scanned, handing the tokens the pipeline keeps to a sink.
+     *
+     * Filtering, interning and number parsing thus happen in the same pass as
+     * the scan, rather than in one pass each over a vector of tokens.
+     *
+     * @param input The buffer to tokenize. It must outlive the tokens when
+     * they are views.
+     * @param stage The Pipeline, or a single stage, to run on every token.
+     * @param sink Called with every ValuedToken the stage keeps, as an rvalue.
+     * @return The number of tokens handed to the sink.
+     */
+    template <typename Stage, typename Sink>
+    std::size_t
+    tokenize_into(std::string_view input, Stage&& stage, Sink&& sink);
+
+    /**
+     * @brief Eagerly tokenizes a buffer owned by the caller into a
+     * structure-of-arrays TokenBuffer.
+     *
+     * The arrays are sized up front from the token density of the start of the
+     * input rather than grown one token at a time.
+     *
+     * @param input The buffer to tokenize. It must outlive the returned
+     * TokenBuffer.
+     * @return The tokens of the input.
+     */
+    TokenBuffer<TokenType> tokenize_buffer(std::string_view input);
+
+    /**
+     * @brief Updates the tokens of a TokenBuffer after an edit of its source.
+     *
+     * Only the tokens the edit can affect are scanned again. Scanning resumes
+     * after the last token that was found without reading anything at or past
+     * the edit, and stops as soon as it reaches a token boundary that the old
+     * scan also had past the edit; the old tokens from there on are kept, with
+     * their offsets, lines and columns shifted. The result is the same as
+     * tokenize_buffer() over the new source.
+     *
+     * Scanning is proportional to the size of the change. The buffer stores
+     * positions relative to its blocks, so only the blocks holding the
+     * rescanned tokens are rewritten, and the blocks after them are shifted by
+     * updating their base offset and line: an edit costs O(block_size +
+     * blocks) on top of the rescan, however far from the end of the buffer it
+     * is.
+     *
+     * Rules matched with std::regex rather than the DFA may look ahead
+     * arbitrarily far, so with such rules scanning resumes at the start. The
+     * buffer does not record the mode stack, so with more than one mode, or if
+     * the edit does not fit the old and new sources, the whole input is
+     * tokenized again.
+     *
+     * @param tokens The tokens of the source before the edit, updated in place.
+     * @param input The source after the edit. It must outlive the TokenBuffer.
+     * @param edit The edit that turned the old source into input.
+     */
+    void retokenize_buffer(TokenBuffer<TokenType>& tokens,
+                           std::string_view input,
+                           const TextEdit& edit);
+
     /**
      * @brief Eagerly tokenizes the entire content of a file into a vector of
      * tokens.
@@ -59,43 +381,60 @@ class Lexer
      * @param filepath The path to the file to tokenize.
      * @return A vector containing all identified tokens.
      */
-    std::vector<Token<TokenType>> tokenize_file(const char* filepath)
+    std::vector<token_t> tokenize_file(const char* filepath)
     {
-        std::ifstream file(filepath);
-
-        std::stringstream buffer;
-        buffer << file.rdbuf();
+        m_file = std::make_shared<const MappedFile>(filepath);
 
-        return tokenize(buffer.str());
+        return tokenize_view(m_file->content());
     }
 
+    /**
+     * @brief Tokenizes a file, or loads its tokens from a cache if they were
+     * saved for the same content and rules.
+     *
+     * On a miss the tokens are scanned and saved, unless the file has lexical
+     * errors: the diagnostics are not cached, and scanning again reports
+     * them again. On a hit, diagnostics() is empty.
+     *
+     * @param filepath The path to the file to tokenize.
+     * @param cache The cache to load from and save to.
+     * @return A vector containing all identified tokens.
+     */
+    std::vector<token_t> tokenize_file(const char* filepath,
+                                       const TokenCache& cache);
+
     /**
      * @brief An input iterator for traversing tokens in a stream.
      *
-     * This class allows for lazy evaluation of the input source, producing
-     * tokens one by one as it is incremented.
+     * This class allows for lazy evaluation of the input source. The tokens
+     * are pulled from the lexer a batch at a time into a ring buffer the lexer
+     * owns, and the iterator only points into it, so stepping and copying an
+     * iterator copy no token. A token stays in the ring until the iterator
+     * has moved twice past it, which keeps the result of `*it++` valid.
      */
     class Iterator
     {
       public:
-        using value_t = Token<TokenType>;
-        using token_r = const Token<TokenType>&;
-        using token_p = const Token<TokenType>*;
+        using value_t = token_t;
+        using token_r = const token_t&;
+        using token_p = const token_t*;
         using it_cat = std::input_iterator_tag;
         using diff_t = std::ptrdiff_t;
 
         Iterator(Lexer* lexer)
             : m_lexer(lexer)
+            , m_current(nullptr)
         {
             advance();
         }
 
         Iterator()
             : m_lexer(nullptr)
+            , m_current(nullptr)
         {}
 
         token_r operator*() const { return *m_current; }
-        token_p operator->() const { return &(*m_current); }
+        token_p operator->() const { return m_current; }
 
         Iterator& operator++()
         {
@@ -129,7 +468,7 @@ class Lexer
         {
             if (m_lexer)
             {
-                m_current = m_lexer->next_token();
+                m_current = m_lexer->next_buffered();
 
                 if (!m_current)
                     m_lexer = nullptr;
@@ -137,7 +476,7 @@ class Lexer
         }
 
         Lexer* m_lexer;
-        std::optional<value_t> m_current;
+        token_p m_current;
     };
 
     /**
@@ -169,10 +508,63 @@ class Lexer
      */
     TokenStream stream(const std::string& content)
     {
+        m_file.reset();
         m_content = content;
-        m_contentIt = m_content.cbegin();
+
+        return stream_view(m_content);
+    }
+
+    /**
+     * @brief Prepares the lexer to scan a buffer owned by the caller, without
+     * copying it.
+     *
+     * @param content The source text to be tokenized. It must outlive the
+     * stream, and the returned tokens when they are views.
+     * @return A TokenStream object for lazy iteration.
+     */
+    TokenStream stream_view(std::string_view content)
+    {
+        m_input = nullptr;
+        m_source = content;
+        m_offset = 0;
         m_current_line_num = 1;
         m_current_col_num = 1;
+        m_reach = 0;
+        m_modes.assign(1, 0);
+        m_dropped = 0;
+        m_diagnostics.clear();
+        m_lines.clear();
+        m_lazy = m_lazy_positions;
+        m_ring_start = m_ring_next = m_ring_end = stream_batch_size;
+
+        return TokenStream(*this);
+    }
+
+    /**
+     * @brief Prepares the lexer to scan an unbounded input, such as a pipe or
+     * standard input, one chunk at a time.
+     *
+     * Only the unconsumed tail of the input is buffered: the lexer keeps at
+     * least one chunk of lookahead, and reads further chunks only while a
+     * token continues past the end of the buffer. Memory use is therefore
+     * bounded by about twice the chunk size plus the longest token.
+     *
+     * Patterns matched with std::regex rather than the DFA are assumed not to
+     * need more than one chunk of lookahead.
+     *
+     * @param input The stream to read from. It must outlive the stream.
+     * @param chunk_size The number of bytes to read at once.
+     * @return A TokenStream object for lazy iteration.
+     */
+    TokenStream stream(std::istream& input,
+                       std::size_t chunk_size = default_chunk_size)
+    {
+        m_file.reset();
+        m_content.clear();
+        stream_view(m_content);
+
+        m_input = &input;
+        m_chunk_size = std::max<std::size_t>(chunk_size, 1);
 
         return TokenStream(*this);
     }
@@ -185,147 +577,778 @@ class Lexer
      */
     TokenStream stream_from_file(const std::string& filepath)
     {
-        std::ifstream file(filepath);
-
-        std::stringstream buffer;
-        buffer << file.rdbuf();
+        m_file = std::make_shared<const MappedFile>(filepath);
 
-        return stream(buffer.str());
+        return stream_view(m_file->content());
     }
 
   private:
     /// @brief The set of rules for identifying tokens.
-    std::vector<TokenDefinition<TokenType>> m_definitions;
-    /// @brief The input string being tokenized.
+    std::shared_ptr<const RuleSet<TokenType>> m_rules;
+    /// @brief The lexer's own copy of the input, when it keeps one.
     std::string m_content;
+    /// @brief The file being tokenized, when the input comes from a file.
+    std::shared_ptr<const MappedFile> m_file;
+    /// @brief The input string being tokenized.
+    std::string_view m_source;
+    /// @brief The offset of the current position in the input string.
+    std::size_t m_offset;
+    /// @brief The stream the input is read from in chunks, if any.
+    std::istream* m_input;
+    /// @brief The number of bytes read from m_input at once.
+    std::size_t m_chunk_size;
     /// @brief The current line number in the input string.
     size_t m_current_line_num;
     /// @brief The current column number on the current line.
     size_t m_current_col_num;
-    /// @brief An iterator pointing to the current position in the input string.
-    std::string::const_iterator m_contentIt;
+    /// @brief The end of the input read by every match so far.
+    std::size_t m_reach;
+    /// @brief The stack of modes entered, the current one last; never empty.
+    std::vector<LexerMode> m_modes;
+    /// @brief The profiling policy.
+    Profiler m_profiler;
+    /// @brief The number of bytes of the input dropped from the front of
+    /// m_content by read_chunk().
+    std::size_t m_dropped = 0;
+    /// @brief How lexical errors are handled, set by set_error_options().
+    ErrorOptions<TokenType> m_error_options;
+    /// @brief Stands in for the definition of error tokens.
+    TokenDefinition<TokenType> m_error_definition{TokenType{}, ""};
+    /// @brief The lexical errors found in the current input, cleared when a
+    /// new input is set.
+    Diagnostics m_diagnostics;
+    /// @brief Whether positions are resolved on demand.
+    bool m_lazy_positions = false;
+    /// @brief Whether positions are resolved on demand for the current input.
+    bool m_lazy = false;
+    /// @brief The start of every line of the input read so far, when
+    /// positions are resolved on demand.
+    LineIndex m_lines;
+    /// @brief The offset in the whole input from which a streamed input must
+    /// stay buffered, while a batch of view tokens points into it.
+    std::size_t m_pinned = static_cast<std::size_t>(-1);
+    /// @brief The ring buffer of TokenStream: two halves of stream_batch_size
+    /// tokens, filled in turn.
+    std::vector<token_t> m_ring;
+    /// @brief The half filled last, and the tokens of it not yet reached.
+    std::size_t m_ring_start = stream_batch_size;
+    std::size_t m_ring_next = stream_batch_size;
+    std::size_t m_ring_end = stream_batch_size;
+
+    /// @brief Whether tokens point into the buffer the lexer scans.
+    static constexpr bool views_input =
+        std::is_same_v<Lexeme, std::string_view>;
+
+    /**
+     * @brief Returns the next token of the ring buffer, refilling the other
+     * half of it once every token of one half has been reached.
+     * @return The token, or nullptr at the end of the input.
+     */
+    const token_t* next_buffered()
+    {
+        if (m_ring_next == m_ring_end)
+        {
+            if (m_ring.empty())
+                m_ring.resize(2 * stream_batch_size);
+
+            // The last token reached is kept, for the result of `*it++`.
+            token_t* kept =
+                m_ring_next > m_ring_start ? &m_ring[m_ring_next - 1] : nullptr;
+
+            m_ring_start = m_ring_start == 0 ? stream_batch_size : 0;
+            m_ring_next = m_ring_start;
+            m_ring_end = m_ring_start + fill(&m_ring[m_ring_start],
+                                             stream_batch_size, kept);
+
+            if (m_ring_next == m_ring_end)
+                return nullptr;
+        }
+
+        return &m_ring[m_ring_next++];
+    }
 
     /**
-     * @brief Handles and reports an unexpected token error.
-     * @param line_num The line number of the error.
-     * @param col_num The column number of the error.
+     * @brief Scans up to a number of tokens into an array.
+     *
+     * While it scans a streamed input, the part of the buffer the tokens point
+     * into is pinned, and afterwards the views are moved to where the buffer
+     * is now.
+     *
+     * @param tokens The array to fill.
+     * @param capacity The size of the array.
+     * @param kept A token pulled earlier whose view must stay valid too, or
+     * nullptr.
+     * @return The number of tokens written.
      */
-    void unexpected_token(int line_num, int col_num);
+    std::size_t fill(token_t* tokens, std::size_t capacity, token_t* kept)
+    {
+        const char* data = m_source.data();
+        std::size_t dropped = m_dropped;
+        std::size_t count = 0;
+
+        if (views_input && m_input)
+            m_pinned = kept ? kept->offset : m_dropped + m_offset;
+
+        for (; count < capacity; count++)
+        {
+            auto scanned = scan();
+
+            if (!scanned)
+                break;
+
+            tokens[count] = make_token(*scanned);
+        }
+
+        m_pinned = static_cast<std::size_t>(-1);
+
+        if constexpr (views_input)
+        {
+            if (m_source.data() != data || m_dropped != dropped)
+            {
+                for (std::size_t i = 0; i < count; i++)
+                    rebase(tokens[i]);
+
+                if (kept)
+                    rebase(*kept);
+            }
+        }
+
+        return count;
+    }
+
+    /**
+     * @brief Points the lexeme of a view token pulled from the current buffer
+     * to where that buffer is now.
+     */
+    void rebase(token_t& token) const
+    {
+        token.lexeme = Lexeme(m_source.data() + (token.offset - m_dropped),
+                              token.lexeme.size());
+    }
 
     /**
-     * @brief Scans the input string for the next valid token.
-     * @return An optional containing the next token, or std::nullopt if the
-     * end is reached.
+     * @brief Copies or moves the state of another lexer, pointing the input
+     * at this lexer's own copy of it where the other lexer owned it.
      */
-    std::optional<Token<TokenType>> next_token();
+    template <typename Other>
+    void assign(Other&& other)
+    {
+        const char* content = other.m_content.data();
+        const char* source = other.m_source.data();
+        bool owned = source >= content &&
+                     source + other.m_source.size() <=
+                         content + other.m_content.size();
+        std::size_t at = owned ? source - content : 0;
+
+        m_rules = other.m_rules;
+        m_content = std::forward<Other>(other).m_content;
+        m_file = std::forward<Other>(other).m_file;
+        m_source = other.m_source;
+        m_offset = other.m_offset;
+        m_input = other.m_input;
+        m_chunk_size = other.m_chunk_size;
+        m_current_line_num = other.m_current_line_num;
+        m_current_col_num = other.m_current_col_num;
+        m_reach = other.m_reach;
+        m_modes = std::forward<Other>(other).m_modes;
+        m_profiler = std::forward<Other>(other).m_profiler;
+        m_dropped = other.m_dropped;
+        m_error_options = std::forward<Other>(other).m_error_options;
+        m_error_definition = other.m_error_definition;
+        m_diagnostics = std::forward<Other>(other).m_diagnostics;
+        m_lazy_positions = other.m_lazy_positions;
+        m_lazy = other.m_lazy;
+        m_lines = std::forward<Other>(other).m_lines;
+        m_pinned = other.m_pinned;
+        m_ring = std::forward<Other>(other).m_ring;
+        m_ring_start = other.m_ring_start;
+        m_ring_next = other.m_ring_next;
+        m_ring_end = other.m_ring_end;
+
+        if (!owned)
+            return;
+
+        m_source = std::string_view(m_content.data() + at, m_source.size());
+
+        if constexpr (views_input)
+            for (std::size_t i = m_ring_start; i < m_ring_end; i++)
+                rebase(m_ring[i]);
+    }
+
+    /**
+     * @brief Extends m_lines over the input up to an offset, or up to the end
+     * of the buffer.
+     * @param offset The offset in the whole input.
+     */
+    void index_lines(std::size_t offset)
+    {
+        std::size_t from = m_lines.indexed();
+        std::size_t to = std::min(offset, m_dropped + m_source.size());
+
+        // The start of the input was dropped before it could be indexed.
+        if (from < m_dropped)
+            return;
+
+        if (to > from)
+            m_lines.extend(m_source.substr(from - m_dropped, to - from), from);
+    }
+
+    /**
+     * @brief Records the error at the current position and finds the bytes to
+     * skip past it.
+     *
+     * When the input is streamed, more of it is read as the skipped bytes
+     * reach the end of the buffer, which moves the buffer; the error then
+     * starts at m_offset in the new one.
+     *
+     * @param begin The current position.
+     * @param end The end of the buffer.
+     * @return The number of bytes to skip, or 0 if the scan ends here.
+     */
+    std::size_t recover(const char* begin, const char* end);
+
+    /**
+     * @brief Drops the consumed part of the buffer and appends the next chunk
+     * of m_input to it.
+     * @return False once m_input is exhausted.
+     */
+    bool read_chunk();
+
+    /**
+     * @brief A token located by scan(), before it is turned into a token_t.
+     */
+    struct Scanned
+    {
+        /// @brief The definition that matched.
+        const TokenDefinition<TokenType>* definition;
+        /// @brief The start of the lexeme in the input.
+        const char* begin;
+        /// @brief The length of the lexeme.
+        std::size_t length;
+        /// @brief The end of the input read by every match before this one.
+        std::size_t reach;
+    };
+
+    /**
+     * @brief Finds the next token that is not discarded, and advances the
+     * position past it.
+     * @return The token, or std::nullopt if the end is reached.
+     */
+    std::optional<Scanned> scan();
+
+    /**
+     * @brief Turns a token located by scan() into a token_t.
+     */
+    token_t make_token(const Scanned& scanned) const;
 };
 
-template <typename TokenType>
-Lexer<TokenType>::Lexer()
-    : m_content("")
-    , m_contentIt(m_content.cbegin())
-    , m_definitions()
-    , m_current_col_num(1)
+template <typename TokenType, typename Lexeme, typename Profiler>
+Lexer<TokenType, Lexeme, Profiler>::Lexer()
+    : m_rules(std::make_shared<const RuleSet<TokenType>>())
+    , m_content("")
+    , m_source()
+    , m_offset(0)
+    , m_input(nullptr)
+    , m_chunk_size(default_chunk_size)
     , m_current_line_num(1)
+    , m_current_col_num(1)
+    , m_reach(0)
+    , m_modes(1, 0)
 {}
 
-template <typename TokenType>
-Lexer<TokenType>::Lexer(std::vector<TokenDefinition<TokenType>> definitions)
-    : m_content("")
-    , m_contentIt(m_content.cbegin())
-    , m_definitions(definitions)
+template <typename TokenType, typename Lexeme, typename Profiler>
+Lexer<TokenType, Lexeme, Profiler>::Lexer(
+    std::vector<TokenDefinition<TokenType>> definitions, LexerBackend backend)
+    : m_rules(
+          std::make_shared<const RuleSet<TokenType>>(definitions, backend))
+    , m_content("")
+    , m_source()
+    , m_offset(0)
+    , m_input(nullptr)
+    , m_chunk_size(default_chunk_size)
+    , m_current_line_num(1)
     , m_current_col_num(1)
+    , m_reach(0)
+    , m_modes(1, 0)
+{}
+
+template <typename TokenType, typename Lexeme, typename Profiler>
+Lexer<TokenType, Lexeme, Profiler>::Lexer(
+    std::shared_ptr<const RuleSet<TokenType>> rules)
+    : m_rules(std::move(rules))
+    , m_content("")
+    , m_source()
+    , m_offset(0)
+    , m_input(nullptr)
+    , m_chunk_size(default_chunk_size)
     , m_current_line_num(1)
+    , m_current_col_num(1)
+    , m_reach(0)
+    , m_modes(1, 0)
 {}
 
-template <typename TokenType>
-Lexer<TokenType>::~Lexer()
+template <typename TokenType, typename Lexeme, typename Profiler>
+Lexer<TokenType, Lexeme, Profiler>::~Lexer()
 {}
 
-template <typename TokenType>
-std::optional<Token<TokenType>> Lexer<TokenType>::next_token()
+template <typename TokenType, typename Lexeme, typename Profiler>
+std::optional<typename Lexer<TokenType, Lexeme, Profiler>::Scanned>
+Lexer<TokenType, Lexeme, Profiler>::scan()
 {
-    if (m_contentIt >= m_content.cend())
+    // An aborted scan has used up its input; scanning again would report the
+    // same error again.
+    if (m_diagnostics.aborted)
         return std::nullopt;
 
-    std::smatch bestMatch;
-    const TokenDefinition<TokenType>* bestDefinition = nullptr;
-
-    for (const auto& definition : m_definitions)
+    // Discarded tokens, and matches redone after reading more input, loop
+    // back here rather than recursing.
+    while (true)
     {
-        std::smatch match;
-        auto regex = definition.regex;
+        while (m_input && m_source.size() - m_offset < m_chunk_size)
+            if (!read_chunk())
+                break;
 
-        if (!std::regex_search(m_contentIt, m_content.cend(), match, regex,
-                               std::regex_constants::match_continuous))
+        if (m_offset >= m_source.size())
+            return std::nullopt;
+
+        const char* begin = m_source.data() + m_offset;
+        const char* end = m_source.data() + m_source.size();
+
+        auto mark = m_profiler.start();
+        Dfa::Match best = m_rules->match(begin, end, m_modes.back());
+
+        // The token may continue in the part of the input not read yet.
+        // Reading moves the buffer, so the match is redone even at the end of
+        // the input.
+        if (best.hit_end && m_input)
+        {
+            read_chunk();
             continue;
+        }
 
-        if (!bestDefinition || match.length() > bestMatch.length())
+        m_profiler.record(*m_rules, m_modes.back(), begin, end, best, mark);
+
+        std::size_t reach = m_reach;
+        m_reach = std::max(m_reach, m_offset + best.scanned);
+
+        auto advance = [this](const char* from, std::size_t length)
         {
-            bestMatch = match;
-            bestDefinition = &definition;
+            if (!m_lazy)
+            {
+                for (const char* c = from; c != from + length; ++c)
+                {
+                    if (*c == '\n')
+                    {
+                        m_current_line_num++;
+                        m_current_col_num = 1;
+                    }
+                    else
+                        m_current_col_num++;
+                }
+            }
+
+            m_offset += length;
+        };
+
+        if (best.length == 0)
+        {
+            std::size_t length = recover(begin, end);
+
+            if (length == 0)
+                return std::nullopt;
+
+            // Recovering may have read more of the input.
+            begin = m_source.data() + m_offset;
+
+            advance(begin, length);
+
+            if (m_error_options.recovery == ErrorRecovery::EmitError)
+                return Scanned{&m_error_definition, begin, length, reach};
+
+            continue;
         }
+
+        const auto* bestDefinition = &m_rules->definitions()[best.rule];
+
+        advance(begin, best.length);
+
+        // The base mode is never popped, so that a stray closing token does
+        // not leave the lexer without a mode.
+        if (bestDefinition->action == ModeAction::Push)
+            m_modes.push_back(bestDefinition->target);
+        else if (bestDefinition->action == ModeAction::Pop &&
+                 m_modes.size() > 1)
+            m_modes.pop_back();
+
+        if (bestDefinition->discard)
+            continue;
+
+        return Scanned{bestDefinition, begin, best.length, reach};
     }
+}
 
-    if (bestMatch.empty())
+template <typename TokenType, typename Lexeme, typename Profiler>
+Token<TokenType, Lexeme>
+Lexer<TokenType, Lexeme, Profiler>::make_token(const Scanned& scanned) const
+{
+    return {
+        .type = scanned.definition->type,
+        .lexeme = Lexeme(scanned.begin, scanned.length),
+        .line = m_lazy ? 0 : static_cast<int>(m_current_line_num),
+        .column = m_lazy ? 0 : static_cast<int>(m_current_col_num),
+        .offset = m_dropped + (scanned.begin - m_source.data()),
+    };
+}
+
+template <typename TokenType, typename Lexeme, typename Profiler>
+bool Lexer<TokenType, Lexeme, Profiler>::read_chunk()
+{
+    // Tokens of the current batch may still point into the buffer.
+    std::size_t drop = std::min(m_offset, m_pinned - m_dropped);
+
+    if (m_lazy)
+        index_lines(m_dropped + drop);
+
+    m_content.erase(0, drop);
+    m_dropped += drop;
+    m_reach -= std::min(m_reach, drop);
+    m_offset -= drop;
+
+    std::size_t size = m_content.size();
+    m_content.resize(size + m_chunk_size);
+    m_input->read(&m_content[size], m_chunk_size);
+    m_content.resize(size + m_input->gcount());
+    m_source = m_content;
+
+    if (m_content.size() == size)
     {
-        unexpected_token(m_current_line_num, m_current_col_num);
-        return std::nullopt;
+        m_input = nullptr;
+        return false;
     }
 
-    auto lexeme = bestMatch.str();
+    return true;
+}
+
+template <typename TokenType, typename Lexeme, typename Profiler>
+std::vector<Token<TokenType, Lexeme>>
+Lexer<TokenType, Lexeme, Profiler>::tokenize(const std::string& input)
+{
+    m_file.reset();
+    m_content = input;
 
-    for (const auto& c : lexeme)
+    return tokenize_view(m_content);
+}
+
+template <typename TokenType, typename Lexeme, typename Profiler>
+std::vector<Token<TokenType, Lexeme>>
+Lexer<TokenType, Lexeme, Profiler>::tokenize_view(std::string_view input)
+{
+    std::vector<token_t> tokens;
+
+    stream_view(input);
+
+    while (auto scanned = scan())
+        tokens.push_back(make_token(*scanned));
+
+    return tokens;
+}
+
+template <typename TokenType, typename Lexeme, typename Profiler>
+std::vector<Token<TokenType, Lexeme>>
+Lexer<TokenType, Lexeme, Profiler>::tokenize_file(const char* filepath,
+                                                  const TokenCache& cache)
+{
+    m_file = std::make_shared<const MappedFile>(filepath);
+
+    std::string_view content = m_file->content();
+    std::uint64_t source_hash = content_hash(content);
+    std::uint64_t rules = m_rules->digest();
+    std::uint32_t flags = m_lazy_positions ? TokenFormat::lazy_positions : 0;
+
+    if (auto reader =
+            cache.load<TokenType>(content, source_hash, rules, flags))
     {
-        if (c == '\n')
+        std::vector<token_t> tokens;
+
+        // Leaves the lexer as if it had scanned the file, for position().
+        stream_view(content);
+        m_offset = content.size();
+        tokens.reserve(reader->size());
+
+        for (const auto& token : *reader)
+            tokens.push_back({
+                .type = token.type,
+                .lexeme = Lexeme(token.lexeme.data(), token.lexeme.size()),
+                .line = token.line,
+                .column = token.column,
+                .offset = token.offset,
+            });
+
+        return tokens;
+    }
+
+    std::vector<token_t> tokens = tokenize_view(content);
+
+    if (m_diagnostics.empty())
+    {
+        TokenWriter<TokenType> writer(rules, flags);
+
+        for (const auto& token : tokens)
+            writer.write(token);
+
+        cache.store(writer.finish(content), source_hash, rules, flags);
+    }
+
+    return tokens;
+}
+
+template <typename TokenType, typename Lexeme, typename Profiler>
+ArenaTokens<TokenType>
+Lexer<TokenType, Lexeme, Profiler>::tokenize_arena(std::string_view input,
+                                                   TokenArena& arena)
+{
+    std::string_view source = arena.copy(input);
+    ArenaTokens<TokenType> tokens{ArenaAllocator<TokenView<TokenType>>(arena)};
+
+    stream_view(source);
+
+    while (auto scanned = scan())
+        tokens.push_back({
+            .type = scanned->definition->type,
+            .lexeme = std::string_view(scanned->begin, scanned->length),
+            .line = m_lazy ? 0 : static_cast<int>(m_current_line_num),
+            .column = m_lazy ? 0 : static_cast<int>(m_current_col_num),
+            .offset = static_cast<std::size_t>(scanned->begin - source.data()),
+        });
+
+    return tokens;
+}
+
+template <typename TokenType, typename Lexeme, typename Profiler>
+template <typename Stage, typename Sink>
+std::size_t Lexer<TokenType, Lexeme, Profiler>::tokenize_into(
+    std::string_view input, Stage&& stage, Sink&& sink)
+{
+    std::size_t count = 0;
+
+    stream_view(input);
+
+    while (auto scanned = scan())
+    {
+        ValuedToken<TokenType, Lexeme> token = {make_token(*scanned)};
+
+        if (stage(token))
         {
-            m_current_line_num++;
-            m_current_col_num = 1;
+            sink(std::move(token));
+            count++;
         }
-        else
-            m_current_col_num++;
     }
 
-    m_contentIt += lexeme.size();
+    return count;
+}
 
-    if (bestDefinition->discard)
-        return next_token();
+template <typename TokenType, typename Lexeme, typename Profiler>
+TokenBuffer<TokenType>
+Lexer<TokenType, Lexeme, Profiler>::tokenize_buffer(std::string_view input)
+{
+    // The density of tokens in this much input sizes the arrays.
+    constexpr std::size_t sample_size = 64 * 1024;
 
-    Token<TokenType> token = {
-        .type = bestDefinition->type,
-        .lexeme = lexeme,
-        .line = m_current_line_num,
-        .column = m_current_col_num,
-    };
+    TokenBuffer<TokenType> tokens(input);
+    bool sized = false;
 
-    return token;
+    tokens.reserve(std::min(input.size(), sample_size) / 4);
+    stream_view(input);
+    m_lazy = false;
+
+    while (auto scanned = scan())
+    {
+        if (!sized && m_offset >= sample_size)
+        {
+            double density = static_cast<double>(tokens.size()) / m_offset;
+            tokens.reserve(
+                static_cast<std::size_t>(density * input.size() * 1.1));
+            sized = true;
+        }
+
+        tokens.push_back(scanned->definition->type,
+                         scanned->begin - input.data(), scanned->length,
+                         m_current_line_num, m_current_col_num,
+                         scanned->reach);
+    }
+
+    return tokens;
 }
 
-template <typename TokenType>
-std::vector<Token<TokenType>>
-Lexer<TokenType>::tokenize(const std::string& input)
+template <typename TokenType, typename Lexeme, typename Profiler>
+void Lexer<TokenType, Lexeme, Profiler>::retokenize_buffer(
+    TokenBuffer<TokenType>& tokens,
+    std::string_view input,
+    const TextEdit& edit)
 {
-    std::vector<Token<TokenType>> tokens;
+    std::size_t old_size = tokens.m_source.size();
 
-    for (const auto& token : stream(input))
-        tokens.push_back(token);
+    if (m_rules->mode_count() > 1 || edit.offset + edit.deleted > old_size ||
+        input.size() != old_size - edit.deleted + edit.inserted.size() ||
+        input.compare(edit.offset, edit.inserted.size(), edit.inserted) != 0)
+    {
+        tokens = tokenize_buffer(input);
+        return;
+    }
 
-    return tokens;
+    std::size_t size = tokens.size();
+    std::size_t delta = edit.inserted.size() - edit.deleted;
+    std::size_t old_edit_end = edit.offset + edit.deleted;
+    std::size_t new_edit_end = edit.offset + edit.inserted.size();
+
+    // Keep the tokens found without reading the edited part. The reach never
+    // decreases, so they are a prefix; scanning resumes after the last one.
+    std::size_t first = tokens.reach_bound(edit.offset);
+
+    if (first > 0)
+        first--;
+
+    stream_view(input);
+    m_lazy = false;
+
+    if (first > 0)
+    {
+        m_offset = tokens.offset(first - 1) + tokens.length(first - 1);
+        m_current_line_num = tokens.line(first - 1);
+        m_current_col_num = tokens.column(first - 1);
+        m_reach = tokens.reach(first);
+    }
+
+    TokenBuffer<TokenType> fresh(input);
+    std::size_t next = tokens.offset_bound(first, old_edit_end);
+    bool converged = false;
+    std::size_t reach = 0;
+
+    while (auto scanned = scan())
+    {
+        std::size_t at = scanned->begin - input.data();
+
+        // Past the edit, the text is the same as before; a token starting
+        // where an old one did starts the same token sequence.
+        if (at >= new_edit_end)
+        {
+            while (next < size && tokens.offset(next) < at - delta)
+                next++;
+
+            if (next < size && tokens.offset(next) == at - delta)
+            {
+                converged = true;
+                reach = scanned->reach;
+                break;
+            }
+        }
+
+        fresh.push_back(scanned->definition->type, at, scanned->length,
+                        m_current_line_num, m_current_col_num,
+                        scanned->reach);
+    }
+
+    std::size_t tail = converged ? next : size;
+    std::size_t old_line = converged ? tokens.line(next) : 0;
+
+    // Columns only move on the line the rescan ended on; later lines start
+    // at the same text as before.
+    tokens.splice(first, tail, fresh,
+                  {
+                      .offset = delta,
+                      .line = m_current_line_num - old_line,
+                      .column = converged
+                                    ? m_current_col_num - tokens.column(next)
+                                    : 0,
+                      .old_line = old_line,
+                      .reach = reach,
+                  });
+    tokens.m_source = input;
 }
 
-template <typename TokenType>
-void Lexer<TokenType>::unexpected_token(int line_num, int col_num)
+template <typename TokenType, typename Lexeme, typename Profiler>
+std::size_t Lexer<TokenType, Lexeme, Profiler>::recover(const char* begin,
+                                                        const char* end)
 {
-    std::string line;
+    Diagnostic error = {m_dropped + m_offset, 0, m_current_line_num,
+                        m_current_col_num};
 
-    // Use a stringstrem to iterate the content line by line
-    std::istringstream input_stream(m_content);
+    if (m_lazy)
+    {
+        SourcePosition at = position(error.offset);
+        error.line = at.line;
+        error.column = at.column;
+    }
+
+    if (m_error_options.print)
+    {
+        // Only the line of the error is looked up, not the whole input. A
+        // streamed input may hold only a part of it.
+        const char* line_start = begin;
+        const char* data = m_source.data();
+
+        while (line_start != data && line_start[-1] != '\n')
+            line_start--;
+
+        const void* line_end = std::memchr(begin, '\n', end - begin);
+
+        Diagnostics::print(
+            std::cerr, error,
+            std::string_view(line_start,
+                             (line_end ? static_cast<const char*>(line_end)
+                                       : end) -
+                                 line_start),
+            error.column - static_cast<std::size_t>(begin - line_start),
+            !line_end && m_input);
+    }
+
+    if (m_error_options.recovery == ErrorRecovery::Abort)
+    {
+        m_diagnostics.errors.push_back(error);
+        m_diagnostics.aborted = true;
+        return 0;
+    }
+
+    const auto& sync = m_error_options.sync;
+    bool to_sync =
+        m_error_options.recovery == ErrorRecovery::SkipToSync && !sync.empty();
+    std::size_t length = 1;
+
+    // Reading keeps the bytes from m_offset on, so the error is not lost.
+    auto read_more = [&]
+    {
+        bool read = read_chunk();
+        begin = m_source.data() + m_offset;
+        end = m_source.data() + m_source.size();
+        return read;
+    };
+
+    while (begin + length < end || (m_input && read_more()))
+    {
+        Dfa::Match match =
+            m_rules->match(begin + length, end, m_modes.back());
+
+        // As in scan(), a match that may continue past the buffer is redone
+        // once more of the input is read.
+        if (match.hit_end && m_input)
+        {
+            read_more();
+            continue;
+        }
+
+        m_reach = std::max(m_reach, m_offset + length + match.scanned);
+
+        if (match.length != 0 &&
+            (!to_sync ||
+             std::find(sync.begin(), sync.end(),
+                       m_rules->definitions()[match.rule].type) != sync.end()))
+            break;
+
+        length++;
+    }
 
-    for (int i = 0; i < line_num; i++)
-        std::getline(input_stream, line);
+    error.length = length;
+    m_diagnostics.errors.push_back(error);
 
-    std::cerr << line << std::endl;
-    std::cerr << std::string(col_num - 1, ' ') << "^" << std::endl;
-    std::cerr << "Unexpected token at line " << line_num << " and column "
-              << col_num << std::endl;
+    return length;
 }
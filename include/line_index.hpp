@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A line and column number, both from 1.
+ */
+struct SourcePosition
+{
+    std::size_t line;
+    std::size_t column;
+};
+
+/**
+ * @brief The offsets at which the lines of a text start, for turning offsets
+ * into line and column numbers without rescanning the text.
+ *
+ * Building the index finds every newline with memchr; each lookup is then a
+ * binary search. Lines and columns are numbered from 1, and a line includes
+ * its terminating '\n'.
+ *
+ * The index can also be built piece by piece with extend(), as a text is read
+ * in chunks; text() is then unavailable.
+ */
+class LineIndex
+{
+  public:
+    /**
+     * @brief Constructs an index of an empty text.
+     */
+    LineIndex()
+        : m_starts(1, 0)
+        , m_indexed(0)
+    {}
+
+    /**
+     * @brief Indexes the lines of a text.
+     *
+     * @param text The text. It need not outlive the index unless text() is
+     * used.
+     */
+    explicit LineIndex(std::string_view text)
+        : LineIndex()
+    {
+        extend(text, 0);
+        m_text = text;
+    }
+
+    /**
+     * @brief Indexes the next piece of the text.
+     *
+     * @param text The piece, which must start where the indexed text ends.
+     * @param offset The offset of the piece in the whole text, which must be
+     * indexed().
+     */
+    void extend(std::string_view text, std::size_t offset)
+    {
+        const char* data = text.data();
+        const char* end = data + text.size();
+
+        for (const char* it = data; it != end; it++)
+        {
+            it = static_cast<const char*>(std::memchr(it, '\n', end - it));
+
+            if (!it)
+                break;
+
+            m_starts.push_back(offset + static_cast<std::size_t>(it - data) +
+                               1);
+        }
+
+        m_indexed = offset + text.size();
+    }
+
+    /**
+     * @brief Empties the index.
+     */
+    void clear()
+    {
+        m_text = {};
+        m_starts.assign(1, 0);
+        m_indexed = 0;
+    }
+
+    /// @brief The size of the text indexed so far.
+    std::size_t indexed() const { return m_indexed; }
+
+    /// @brief The number of lines; a text ending with '\n' has an empty last
+    /// line.
+    std::size_t line_count() const { return m_starts.size(); }
+
+    /// @brief The offset at which every line starts, in order.
+    const std::vector<std::size_t>& starts() const { return m_starts; }
+
+    /**
+     * @brief The line an offset is on.
+     *
+     * @param offset The offset into the text.
+     * @return The line number, from 1.
+     */
+    std::size_t line(std::size_t offset) const
+    {
+        return std::upper_bound(m_starts.begin(), m_starts.end(), offset) -
+               m_starts.begin();
+    }
+
+    /**
+     * @brief The column of an offset on its line.
+     *
+     * @param offset The offset into the text.
+     * @return The column number, from 1.
+     */
+    std::size_t column(std::size_t offset) const
+    {
+        return offset - m_starts[line(offset) - 1] + 1;
+    }
+
+    /**
+     * @brief The line and column of an offset.
+     *
+     * @param offset The offset into the text.
+     */
+    SourcePosition position(std::size_t offset) const
+    {
+        std::size_t number = line(offset);
+
+        return {number, offset - m_starts[number - 1] + 1};
+    }
+
+    /**
+     * @brief The text of a line, without its terminating newline.
+     *
+     * @param line The line number, from 1.
+     * @return The text, or an empty view past the last line or if the index
+     * was built with extend().
+     */
+    std::string_view text(std::size_t line) const
+    {
+        if (line == 0 || line > m_starts.size() || m_text.size() != m_indexed)
+            return {};
+
+        std::size_t start = m_starts[line - 1];
+        std::size_t end =
+            line < m_starts.size() ? m_starts[line] - 1 : m_text.size();
+
+        return m_text.substr(start, end - start);
+    }
+
+  private:
+    std::string_view m_text;
+    std::vector<std::size_t> m_starts;
+    std::size_t m_indexed;
+};
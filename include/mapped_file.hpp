@@ -0,0 +1,245 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define LEXER_HAS_MMAP 1
+#else
+#define LEXER_HAS_MMAP 0
+#endif
+
+/**
+ * @brief A read-only view of a whole file.
+ *
+ * Where available the file is memory-mapped, so that its content is paged in
+ * on demand instead of being copied into memory; the mapping is advised as
+ * sequential, which is how the lexer reads it. On other platforms, or if the
+ * mapping fails, the file is read into an owned buffer instead.
+ *
+ * The view returned by content() stays valid until the MappedFile is closed,
+ * reassigned or destroyed.
+ */
+class MappedFile
+{
+  public:
+    /**
+     * @brief Constructs a MappedFile that holds no file.
+     */
+    MappedFile()
+        : m_data(nullptr)
+        , m_size(0)
+        , m_mapped(false)
+    {}
+
+    /**
+     * @brief Opens and maps the given file.
+     *
+     * @param filepath The path to the file.
+     */
+    explicit MappedFile(const std::string& filepath)
+        : MappedFile()
+    {
+        open(filepath);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept
+        : MappedFile()
+    {
+        swap(other);
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            swap(other);
+        }
+
+        return *this;
+    }
+
+    ~MappedFile() { close(); }
+
+    /**
+     * @brief Opens and maps the given file, releasing any previous one.
+     *
+     * @param filepath The path to the file.
+     * @return False if the file could not be read, in which case the content
+     * is empty.
+     */
+    bool open(const std::string& filepath)
+    {
+        close();
+
+#if LEXER_HAS_MMAP
+        int fd = ::open(filepath.c_str(), O_RDONLY);
+
+        if (fd >= 0)
+        {
+            struct stat info;
+
+            if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+            {
+                m_size = static_cast<std::size_t>(info.st_size);
+
+                // Mapping an empty file fails, but there is nothing to map.
+                if (m_size == 0)
+                {
+                    ::close(fd);
+                    return true;
+                }
+
+                void* data =
+                    ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if (data != MAP_FAILED)
+                {
+                    ::madvise(data, m_size, MADV_SEQUENTIAL);
+                    ::close(fd);
+
+                    m_data = static_cast<const char*>(data);
+                    m_mapped = true;
+                    return true;
+                }
+
+                m_size = 0;
+            }
+
+            ::close(fd);
+        }
+#endif
+
+        // Pipes, special files and platforms without mmap are read instead.
+        std::ifstream file(filepath, std::ios::binary);
+
+        if (!file)
+            return false;
+
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+
+        m_buffer = buffer.str();
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+        return true;
+    }
+
+    /**
+     * @brief Releases the file.
+     */
+    void close()
+    {
+#if LEXER_HAS_MMAP
+        if (m_mapped)
+            ::munmap(const_cast<char*>(m_data), m_size);
+#endif
+
+        m_buffer.clear();
+        m_data = nullptr;
+        m_size = 0;
+        m_mapped = false;
+    }
+
+    /// @brief The content of the file.
+    std::string_view content() const { return {m_data, m_size}; }
+
+    /// @brief Whether the content is backed by a memory mapping.
+    bool mapped() const { return m_mapped; }
+
+  private:
+    /// @brief The start of the content.
+    const char* m_data;
+    /// @brief The size of the content in bytes.
+    std::size_t m_size;
+    /// @brief Whether m_data points to a mapping rather than m_buffer.
+    bool m_mapped;
+    /// @brief The content, when the file could not be mapped.
+    std::string m_buffer;
+
+    void swap(MappedFile& other) noexcept
+    {
+        bool other_owned = !other.m_mapped && other.m_data;
+        bool owned = !m_mapped && m_data;
+
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_mapped, other.m_mapped);
+        std::swap(m_buffer, other.m_buffer);
+
+        // Small buffers live inside the string object, so their address moves
+        // with the swap.
+        if (other_owned)
+            m_data = m_buffer.data();
+        if (owned)
+            other.m_data = other.m_buffer.data();
+    }
+};
+
+/**
+ * @brief Writes a file as a whole, replacing any file at the path without
+ * ever truncating it, so that a MappedFile of the old file stays valid and a
+ * concurrent open sees either the old or the new content, never a partial one.
+ *
+ * The data is written to a temporary file in the same directory, named after
+ * the process, the thread and a counter so that concurrent writers of the
+ * same path do not write into each other's file, and then renamed over the
+ * path; the last rename wins.
+ *
+ * @param filepath The path to the file.
+ * @param data The content of the file.
+ * @return False if the file could not be written.
+ */
+inline bool replace_file(const std::string& filepath, std::string_view data)
+{
+    static std::atomic<unsigned long long> counter{0};
+
+#if LEXER_HAS_MMAP
+    auto process = static_cast<unsigned long long>(getpid());
+#else
+    unsigned long long process = 0;
+#endif
+
+    char suffix[64];
+    std::snprintf(suffix, sizeof(suffix), ".%llx-%llx-%llx.tmp", process,
+                  static_cast<unsigned long long>(
+                      std::hash<std::thread::id>()(std::this_thread::get_id())),
+                  counter.fetch_add(1, std::memory_order_relaxed));
+    std::string temporary = filepath + suffix;
+
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+
+        if (!file.write(data.data(),
+                        static_cast<std::streamsize>(data.size())))
+        {
+            file.close();
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(temporary.c_str(), filepath.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,354 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "lexer.hpp"
+#include "rule_set.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * @brief Options for tokenize_parallel().
+ */
+struct ParallelOptions
+{
+    /// @brief The number of worker threads; 0 uses one per hardware thread.
+    std::size_t threads = 0;
+    /// @brief The number of chunks the input is split into; 0 uses one per
+    /// worker.
+    std::size_t chunks = 0;
+    /// @brief Inputs are not split into chunks smaller than this.
+    std::size_t min_chunk_size = 256 * 1024;
+    /// @brief Chunks start right after this byte, where a token is most likely
+    /// to start.
+    char sync_byte = '\n';
+    /// @brief Also tokenize sequentially and report any difference on
+    /// std::cerr. The sequential result is returned in that case.
+    bool verify = false;
+};
+
+/**
+ * @brief Advances a line and column position over a range of the input, the
+ * way the lexer counts them.
+ *
+ * @param from The start of the range.
+ * @param to The end of the range.
+ * @param line The line number, updated in place.
+ * @param column The column number, updated in place.
+ */
+inline void advance_position(const char* from,
+                             const char* to,
+                             std::size_t& line,
+                             std::size_t& column)
+{
+    const char* last_newline = nullptr;
+
+    for (const char* it = from; it != to; it++)
+    {
+        it = static_cast<const char*>(std::memchr(it, '\n', to - it));
+
+        if (!it)
+            break;
+
+        line++;
+        last_newline = it;
+    }
+
+    if (last_newline)
+        column = to - last_newline;
+    else
+        column += to - from;
+}
+
+/**
+ * @brief Tokenizes a single large input on several threads.
+ *
+ * The input is split into chunks that start right after a sync byte, and
+ * every chunk is scanned speculatively on its own thread as if a token started
+ * there. The chunks are then stitched together in order: once the exact scan
+ * coming from the previous chunk reaches a position where the speculative
+ * scan also had a token boundary, the two scans are identical from there on
+ * and the rest of the chunk is taken as is. When they never meet, the exact
+ * scan simply continues through the chunk. Line and column numbers are
+ * computed afterwards, again in parallel.
+ *
+ * The result is therefore always the same as scanning the input sequentially
+ * with a Lexer over the same rules. On a lexical error, where the sequential
+ * lexer reports the error and stops, the input is rescanned sequentially to
+ * produce exactly that report.
+ *
+ * A chunk cannot tell which mode the lexer is in where it starts, so rule
+ * sets with more than one mode are always tokenized sequentially.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ * @tparam Lexeme The type holding the text of each token.
+ * @param rules The rule set to scan with.
+ * @param input The text to tokenize. With view lexemes, it must outlive the
+ * returned tokens.
+ * @param options Controls threading, chunking and verification.
+ * @return The tokens of the input.
+ */
+template <typename TokenType, typename Lexeme = std::string>
+std::vector<Token<TokenType, Lexeme>>
+tokenize_parallel(const std::shared_ptr<const RuleSet<TokenType>>& rules,
+                  std::string_view input,
+                  const ParallelOptions& options = {})
+{
+    using token_t = Token<TokenType, Lexeme>;
+
+    struct Boundary
+    {
+        /// @brief The offset the token starts at.
+        std::size_t offset;
+        std::uint32_t rule;
+    };
+
+    struct Segment
+    {
+        /// @brief The offset the speculative scan started at.
+        std::size_t start;
+        /// @brief Every token of the scan, including discarded ones.
+        std::vector<Boundary> tokens;
+        /// @brief The offset the scan stopped at.
+        std::size_t end;
+        /// @brief Whether the scan stopped at a lexical error.
+        bool error = false;
+    };
+
+    auto sequential = [&]()
+    { return Lexer<TokenType, Lexeme>(rules).tokenize_view(input); };
+
+    const auto& definitions = rules->definitions();
+    const char* data = input.data();
+    const char* data_end = data + input.size();
+
+    std::size_t threads = options.threads;
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::size_t chunks = options.chunks ? options.chunks : threads;
+    chunks = std::min(chunks,
+                      input.size() / std::max<std::size_t>(
+                                         options.min_chunk_size, 1));
+
+    std::vector<Segment> segments;
+    segments.push_back({0, {}, 0});
+
+    for (std::size_t i = 1; i < chunks; i++)
+    {
+        const char* split = data + input.size() / chunks * i;
+        const void* sync =
+            std::memchr(split, options.sync_byte, data_end - split);
+
+        if (!sync)
+            break;
+
+        std::size_t start = static_cast<const char*>(sync) - data + 1;
+
+        if (start > segments.back().start && start < input.size())
+            segments.push_back({start, {}, start});
+    }
+
+    if (rules->mode_count() > 1 || (segments.size() < 2 && !options.verify))
+        return sequential();
+
+    WorkStealingPool pool(threads);
+
+    // Scan every chunk speculatively, up to the first token boundary at or
+    // past the start of the next chunk.
+    for (std::size_t i = 0; i < segments.size(); i++)
+    {
+        pool.submit(
+            [&, i](std::size_t)
+            {
+                Segment& segment = segments[i];
+                std::size_t limit = i + 1 < segments.size()
+                                        ? segments[i + 1].start
+                                        : input.size();
+                std::size_t offset = segment.start;
+
+                while (offset < limit)
+                {
+                    Dfa::Match match = rules->match(data + offset, data_end);
+
+                    if (match.length == 0)
+                    {
+                        segment.error = true;
+                        break;
+                    }
+
+                    segment.tokens.push_back({offset, match.rule});
+                    offset += match.length;
+                }
+
+                segment.end = offset;
+            });
+    }
+
+    pool.wait();
+
+    // Stitch the chunks together, following the exact token boundaries.
+    std::vector<Boundary> tokens;
+    std::vector<std::size_t> ends;
+    std::size_t offset = 0;
+    bool error = false;
+
+    auto take = [&](const Boundary& token, std::size_t end)
+    {
+        if (definitions[token.rule].discard)
+            return;
+
+        tokens.push_back(token);
+        ends.push_back(end);
+    };
+
+    for (std::size_t i = 0; i < segments.size() && !error; i++)
+    {
+        const Segment& segment = segments[i];
+        std::size_t limit =
+            i + 1 < segments.size() ? segments[i + 1].start : input.size();
+
+        while (true)
+        {
+            auto it = std::lower_bound(segment.tokens.begin(),
+                                       segment.tokens.end(), offset,
+                                       [](const Boundary& token, std::size_t at)
+                                       { return token.offset < at; });
+
+            if ((it != segment.tokens.end() && it->offset == offset) ||
+                offset == segment.end)
+            {
+                for (; it != segment.tokens.end(); ++it)
+                {
+                    auto next = it + 1;
+                    take(*it, next != segment.tokens.end() ? next->offset
+                                                           : segment.end);
+                }
+
+                offset = segment.end;
+                error = segment.error;
+                break;
+            }
+
+            if (offset >= std::max(limit, segment.end))
+                break;
+
+            Dfa::Match match = rules->match(data + offset, data_end);
+
+            if (match.length == 0)
+            {
+                error = true;
+                break;
+            }
+
+            take({offset, match.rule}, offset + match.length);
+            offset += match.length;
+        }
+    }
+
+    if (error)
+        return sequential();
+
+    // Compute the position after every token, slice by slice: first the
+    // position at the start of each slice, then every slice on its own.
+    std::size_t slices = std::max<std::size_t>(
+        1, std::min(pool.size(), tokens.size() / 1024));
+    std::vector<std::size_t> firsts(slices + 1);
+    std::vector<std::size_t> lines(slices + 1, 1);
+    std::vector<std::size_t> columns(slices + 1, 1);
+
+    for (std::size_t j = 0; j <= slices; j++)
+        firsts[j] = tokens.size() / slices * j;
+
+    firsts[slices] = tokens.size();
+
+    auto slice_start = [&](std::size_t j)
+    { return j == 0 ? 0 : tokens[firsts[j]].offset; };
+
+    for (std::size_t j = 1; j < slices; j++)
+    {
+        pool.submit(
+            [&, j](std::size_t)
+            {
+                // Relative to the start of the previous slice.
+                lines[j] = 0;
+                columns[j] = 0;
+                advance_position(data + slice_start(j - 1),
+                                 data + slice_start(j), lines[j], columns[j]);
+            });
+    }
+
+    pool.wait();
+
+    for (std::size_t j = 1; j < slices; j++)
+    {
+        std::size_t column = columns[j];
+
+        if (lines[j] == 0)
+            column += columns[j - 1];
+
+        lines[j] += lines[j - 1];
+        columns[j] = column;
+    }
+
+    std::vector<token_t> result(tokens.size());
+
+    for (std::size_t j = 0; j < slices; j++)
+    {
+        pool.submit(
+            [&, j](std::size_t)
+            {
+                std::size_t line = lines[j];
+                std::size_t column = columns[j];
+                std::size_t at = slice_start(j);
+
+                for (std::size_t k = firsts[j]; k < firsts[j + 1]; k++)
+                {
+                    advance_position(data + at, data + ends[k], line, column);
+                    at = ends[k];
+
+                    result[k] = {
+                        .type = definitions[tokens[k].rule].type,
+                        .lexeme = Lexeme(data + tokens[k].offset,
+                                         ends[k] - tokens[k].offset),
+                        .line = static_cast<int>(line),
+                        .column = static_cast<int>(column),
+                        .offset = tokens[k].offset,
+                    };
+                }
+            });
+    }
+
+    pool.wait();
+
+    if (options.verify)
+    {
+        auto expected = sequential();
+        std::size_t mismatch = 0;
+
+        while (mismatch < expected.size() && mismatch < result.size() &&
+               expected[mismatch].type == result[mismatch].type &&
+               expected[mismatch].lexeme == result[mismatch].lexeme &&
+               expected[mismatch].line == result[mismatch].line &&
+               expected[mismatch].column == result[mismatch].column)
+            mismatch++;
+
+        if (mismatch != expected.size() || mismatch != result.size())
+        {
+            std::cerr << "Parallel tokenization diverged at token " << mismatch
+                      << " of " << expected.size() << std::endl;
+            return expected;
+        }
+    }
+
+    return result;
+}
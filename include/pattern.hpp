@@ -0,0 +1,680 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief A set of bytes, usable in constant expressions.
+ */
+struct ByteSet
+{
+    std::uint64_t words[4] = {};
+
+    /// @brief Returns the set of bytes in [lo, hi].
+    static constexpr ByteSet range(unsigned lo, unsigned hi)
+    {
+        ByteSet set;
+
+        for (unsigned c = lo; c <= hi && c < 256; c++)
+            set.set(c);
+
+        return set;
+    }
+
+    constexpr void set(unsigned c)
+    {
+        words[c >> 6] |= std::uint64_t(1) << (c & 63);
+    }
+
+    constexpr bool test(unsigned c) const
+    {
+        return (words[c >> 6] >> (c & 63)) & 1;
+    }
+
+    constexpr unsigned count() const
+    {
+        unsigned count = 0;
+
+        for (unsigned c = 0; c < 256; c++)
+            count += test(c);
+
+        return count;
+    }
+
+    /// @brief The smallest byte in the set, or 256 if it is empty.
+    constexpr unsigned first() const
+    {
+        for (unsigned c = 0; c < 256; c++)
+            if (test(c))
+                return c;
+
+        return 256;
+    }
+
+    constexpr ByteSet& operator|=(const ByteSet& other)
+    {
+        for (int i = 0; i < 4; i++)
+            words[i] |= other.words[i];
+
+        return *this;
+    }
+
+    constexpr ByteSet operator|(const ByteSet& other) const
+    {
+        ByteSet set = *this;
+        set |= other;
+        return set;
+    }
+
+    constexpr ByteSet operator~() const
+    {
+        ByteSet set;
+
+        for (int i = 0; i < 4; i++)
+            set.words[i] = ~words[i];
+
+        return set;
+    }
+};
+
+/**
+ * @brief A state of a Thompson NFA.
+ *
+ * A state either moves to `next` on a byte in `set`, or has up to two epsilon
+ * moves; the construction in NfaBuilder never needs more than two.
+ */
+struct NfaState
+{
+    /// @brief Marks an absent transition, or a state that accepts no rule.
+    static constexpr std::uint32_t none = UINT32_MAX;
+
+    /// @brief The bytes that lead to `next`.
+    ByteSet set;
+    std::uint32_t next = none;
+    std::uint32_t epsilon[2] = {none, none};
+    /// @brief The rule accepted in this state, or none.
+    std::uint32_t rule = none;
+};
+
+/**
+ * @brief NFA storage in a fixed-size array, for use in constant expressions.
+ *
+ * States past the capacity are counted but not stored, so that a first pass
+ * with a capacity of one measures the size a second pass needs.
+ *
+ * @tparam Capacity The number of states that can be stored.
+ */
+template <std::size_t Capacity>
+struct StaticNfa
+{
+    NfaState states[Capacity] = {};
+    std::size_t count = 0;
+    /// @brief Stands in for every state past the capacity.
+    NfaState overflow = {};
+
+    constexpr std::uint32_t add()
+    {
+        if (count < Capacity)
+            states[count] = NfaState{};
+
+        return static_cast<std::uint32_t>(count++);
+    }
+
+    constexpr NfaState& operator[](std::size_t index)
+    {
+        if (index < Capacity)
+            return states[index];
+
+        overflow = NfaState{};
+        return overflow;
+    }
+
+    constexpr const NfaState& operator[](std::size_t index) const
+    {
+        return index < Capacity ? states[index] : overflow;
+    }
+
+    constexpr std::size_t size() const { return count; }
+};
+
+/**
+ * @brief NFA storage in a growable vector, for use at runtime.
+ */
+struct VectorNfa
+{
+    std::vector<NfaState> states;
+
+    std::uint32_t add()
+    {
+        states.emplace_back();
+        return static_cast<std::uint32_t>(states.size() - 1);
+    }
+
+    NfaState& operator[](std::size_t index) { return states[index]; }
+    const NfaState& operator[](std::size_t index) const
+    {
+        return states[index];
+    }
+
+    std::size_t size() const { return states.size(); }
+};
+
+/**
+ * @brief Parses token patterns straight into a Thompson NFA.
+ *
+ * The parser accepts the ECMAScript syntax understood by std::regex, but
+ * rejects every construct whose meaning cannot be captured by a DFA (anchors,
+ * word boundaries, back-references, lookaheads and lazy quantifiers), so that
+ * the caller can fall back to std::regex for those patterns.
+ *
+ * Every pattern becomes an alternative of a shared start state, and its final
+ * state accepts the pattern's rule index. All of it can run in a constant
+ * expression, so the same code compiles patterns at runtime and at compile
+ * time.
+ *
+ * @tparam Nfa The storage for the states, StaticNfa or VectorNfa.
+ */
+template <typename Nfa>
+class NfaBuilder
+{
+  public:
+    /// @brief The largest repetition count that is expanded into the automaton.
+    static constexpr int max_repeat = 1000;
+
+    /**
+     * @brief Starts an NFA with an empty start state.
+     *
+     * @param nfa The storage to build into.
+     */
+    constexpr explicit NfaBuilder(Nfa& nfa)
+        : m_nfa(nfa)
+        , m_start(nfa.add())
+        , m_split(m_start)
+        , m_pattern(nullptr)
+        , m_size(0)
+        , m_pos(0)
+        , m_failed(false)
+    {}
+
+    /// @brief The start state of the NFA.
+    constexpr std::uint32_t start() const { return m_start; }
+
+    /**
+     * @brief Adds a pattern as a new alternative of the start state.
+     *
+     * @param pattern The pattern text.
+     * @param size The length of the pattern text.
+     * @param rule The rule index the pattern accepts with.
+     * @return False, leaving the NFA's language unchanged, if the pattern uses
+     * syntax the builder does not support.
+     */
+    constexpr bool add_pattern(const char* pattern,
+                               std::size_t size,
+                               std::uint32_t rule)
+    {
+        m_pattern = pattern;
+        m_size = size;
+        m_pos = 0;
+        m_failed = false;
+
+        Fragment fragment = parse_alternation();
+
+        if (m_failed || !at_end())
+            return false;
+
+        m_nfa[fragment.end].rule = rule;
+
+        // Chain the alternatives through split states, so that no state
+        // needs more than two epsilon moves.
+        std::uint32_t split = m_nfa.add();
+        epsilon(m_split, fragment.start);
+        epsilon(m_split, split);
+        m_split = split;
+
+        return true;
+    }
+
+  private:
+    struct Fragment
+    {
+        std::uint32_t start;
+        std::uint32_t end;
+    };
+
+    Nfa& m_nfa;
+    std::uint32_t m_start;
+    /// @brief The state the next alternative is attached to.
+    std::uint32_t m_split;
+    const char* m_pattern;
+    std::size_t m_size;
+    std::size_t m_pos;
+    bool m_failed;
+
+    constexpr bool at_end() const { return m_pos >= m_size; }
+    constexpr char peek() const { return m_pattern[m_pos]; }
+
+    constexpr Fragment fail()
+    {
+        m_failed = true;
+        return {m_start, m_start};
+    }
+
+    constexpr void epsilon(std::uint32_t from, std::uint32_t to)
+    {
+        NfaState& state = m_nfa[from];
+
+        if (state.epsilon[0] == NfaState::none)
+            state.epsilon[0] = to;
+        else if (state.epsilon[1] == NfaState::none)
+            state.epsilon[1] = to;
+        else
+            m_failed = true;
+    }
+
+    constexpr Fragment bytes(const ByteSet& set)
+    {
+        Fragment fragment = {m_nfa.add(), 0};
+        fragment.end = m_nfa.add();
+        m_nfa[fragment.start].set = set;
+        m_nfa[fragment.start].next = fragment.end;
+        return fragment;
+    }
+
+    constexpr Fragment chain(Fragment first, Fragment second)
+    {
+        epsilon(first.end, second.start);
+        return {first.start, second.end};
+    }
+
+    constexpr Fragment alternate(Fragment first, Fragment second)
+    {
+        Fragment fragment = {m_nfa.add(), 0};
+        fragment.end = m_nfa.add();
+        epsilon(fragment.start, first.start);
+        epsilon(fragment.start, second.start);
+        epsilon(first.end, fragment.end);
+        epsilon(second.end, fragment.end);
+        return fragment;
+    }
+
+    constexpr Fragment optional(Fragment body)
+    {
+        Fragment fragment = {m_nfa.add(), 0};
+        fragment.end = m_nfa.add();
+        epsilon(fragment.start, body.start);
+        epsilon(fragment.start, fragment.end);
+        epsilon(body.end, fragment.end);
+        return fragment;
+    }
+
+    constexpr Fragment star(Fragment body)
+    {
+        Fragment fragment = {m_nfa.add(), 0};
+        fragment.end = m_nfa.add();
+        epsilon(fragment.start, body.start);
+        epsilon(fragment.start, fragment.end);
+        epsilon(body.end, fragment.start);
+        return fragment;
+    }
+
+    constexpr Fragment plus(Fragment body)
+    {
+        std::uint32_t loop = m_nfa.add();
+        std::uint32_t end = m_nfa.add();
+        epsilon(body.end, loop);
+        epsilon(loop, body.start);
+        epsilon(loop, end);
+        return {body.start, end};
+    }
+
+    constexpr Fragment parse_alternation()
+    {
+        Fragment fragment = parse_concatenation();
+
+        while (!m_failed && !at_end() && peek() == '|')
+        {
+            m_pos++;
+            fragment = alternate(fragment, parse_concatenation());
+        }
+
+        return fragment;
+    }
+
+    constexpr Fragment parse_concatenation()
+    {
+        std::uint32_t start = m_nfa.add();
+        Fragment fragment = {start, start};
+
+        while (!m_failed && !at_end() && peek() != '|' && peek() != ')')
+            fragment = chain(fragment, parse_repetition());
+
+        return fragment;
+    }
+
+    constexpr Fragment parse_repetition()
+    {
+        std::size_t atom_start = m_pos;
+        Fragment atom = parse_atom();
+
+        if (m_failed || at_end())
+            return atom;
+
+        int min = 0;
+        int max = -1;
+
+        switch (peek())
+        {
+        case '*':
+            m_pos++;
+            break;
+        case '+':
+            min = 1;
+            m_pos++;
+            break;
+        case '?':
+            max = 1;
+            m_pos++;
+            break;
+        case '{':
+            if (!parse_bounds(min, max))
+                return fail();
+            break;
+        default:
+            return atom;
+        }
+
+        // Lazy quantifiers pick the shortest match, which a longest-match
+        // automaton cannot reproduce; stacked quantifiers are invalid.
+        if (!at_end() && (peek() == '?' || peek() == '*' || peek() == '+' ||
+                          peek() == '{'))
+            return fail();
+
+        if (min == 0 && max == -1)
+            return star(atom);
+        if (min == 1 && max == -1)
+            return plus(atom);
+
+        // Counted repetitions expand into copies of the atom, which is parsed
+        // again for each copy.
+        std::size_t resume = m_pos;
+        int copies = max == -1 ? min + 1 : max;
+        Fragment fragment = {0, 0};
+
+        if (copies == 0)
+        {
+            std::uint32_t state = m_nfa.add();
+            fragment = {state, state};
+        }
+
+        for (int i = 0; i < copies && !m_failed; i++)
+        {
+            Fragment copy = atom;
+
+            if (i > 0)
+            {
+                m_pos = atom_start;
+                copy = parse_atom();
+            }
+
+            if (i >= min)
+                copy = max == -1 ? star(copy) : optional(copy);
+
+            fragment = i == 0 ? copy : chain(fragment, copy);
+        }
+
+        m_pos = resume;
+        return fragment;
+    }
+
+    constexpr bool parse_number(int& value)
+    {
+        std::size_t start = m_pos;
+        value = 0;
+
+        while (!at_end() && peek() >= '0' && peek() <= '9')
+        {
+            value = value * 10 + (peek() - '0');
+
+            if (value > max_repeat)
+                return false;
+
+            m_pos++;
+        }
+
+        return m_pos != start;
+    }
+
+    constexpr bool parse_bounds(int& min, int& max)
+    {
+        m_pos++;
+
+        if (!parse_number(min))
+            return false;
+
+        max = min;
+
+        if (!at_end() && peek() == ',')
+        {
+            m_pos++;
+            max = -1;
+
+            if (!at_end() && peek() != '}' && !parse_number(max))
+                return false;
+        }
+
+        if (at_end() || peek() != '}' || (max != -1 && max < min))
+            return false;
+
+        m_pos++;
+        return true;
+    }
+
+    constexpr Fragment parse_atom()
+    {
+        char c = peek();
+
+        switch (c)
+        {
+        case '(':
+        {
+            m_pos++;
+
+            if (m_pos + 1 < m_size && peek() == '?' &&
+                m_pattern[m_pos + 1] == ':')
+                m_pos += 2;
+            else if (!at_end() && peek() == '?')
+                return fail();
+
+            Fragment inner = parse_alternation();
+
+            if (m_failed || at_end() || peek() != ')')
+                return fail();
+
+            m_pos++;
+            return inner;
+        }
+        case '[':
+            return bytes(parse_class());
+        case '.':
+            m_pos++;
+            return bytes(~(single('\n') | single('\r')));
+        case '\\':
+            m_pos++;
+            return bytes(parse_escape(false));
+        case '^':
+        case '$':
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            return fail();
+        default:
+            m_pos++;
+            return bytes(single(static_cast<unsigned char>(c)));
+        }
+    }
+
+    static constexpr ByteSet digits() { return ByteSet::range('0', '9'); }
+
+    static constexpr ByteSet spaces()
+    {
+        return ByteSet::range('\t', '\r') | ByteSet::range(' ', ' ');
+    }
+
+    static constexpr ByteSet word()
+    {
+        return ByteSet::range('a', 'z') | ByteSet::range('A', 'Z') | digits() |
+               ByteSet::range('_', '_');
+    }
+
+    static constexpr ByteSet single(unsigned char c)
+    {
+        return ByteSet::range(c, c);
+    }
+
+    constexpr ByteSet parse_escape(bool in_class)
+    {
+        if (at_end())
+        {
+            m_failed = true;
+            return {};
+        }
+
+        char c = peek();
+        m_pos++;
+
+        switch (c)
+        {
+        case 'd':
+            return digits();
+        case 'D':
+            return ~digits();
+        case 's':
+            return spaces();
+        case 'S':
+            return ~spaces();
+        case 'w':
+            return word();
+        case 'W':
+            return ~word();
+        case 't':
+            return single('\t');
+        case 'n':
+            return single('\n');
+        case 'r':
+            return single('\r');
+        case 'f':
+            return single('\f');
+        case 'v':
+            return single('\v');
+        case 'b':
+            // Outside of a class this is a word boundary assertion.
+            if (!in_class)
+                m_failed = true;
+            return single('\b');
+        case '0':
+            if (!at_end() && peek() >= '0' && peek() <= '9')
+                m_failed = true;
+            return single('\0');
+        case 'x':
+        {
+            unsigned value = 0;
+
+            for (int i = 0; i < 2; i++)
+            {
+                char h = at_end() ? '\0' : m_pattern[m_pos++];
+                value <<= 4;
+
+                if (h >= '0' && h <= '9')
+                    value |= h - '0';
+                else if (h >= 'a' && h <= 'f')
+                    value |= h - 'a' + 10;
+                else if (h >= 'A' && h <= 'F')
+                    value |= h - 'A' + 10;
+                else
+                    m_failed = true;
+            }
+
+            return single(static_cast<unsigned char>(value));
+        }
+        default:
+            // Identity escapes are only well defined for punctuation; letters
+            // and digits denote back-references or extensions.
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                (c >= '0' && c <= '9'))
+                m_failed = true;
+            return single(static_cast<unsigned char>(c));
+        }
+    }
+
+    constexpr ByteSet parse_class()
+    {
+        m_pos++;
+
+        bool negate = !at_end() && peek() == '^';
+
+        if (negate)
+            m_pos++;
+
+        // "[]" and "[^]" are treated differently across regex flavours.
+        if (!at_end() && peek() == ']')
+            m_failed = true;
+
+        ByteSet set;
+
+        while (!m_failed && !at_end() && peek() != ']')
+        {
+            ByteSet lo = parse_class_atom();
+
+            if (m_pos + 1 < m_size && peek() == '-' &&
+                m_pattern[m_pos + 1] != ']')
+            {
+                m_pos++;
+
+                ByteSet hi = parse_class_atom();
+
+                if (lo.count() != 1 || hi.count() != 1)
+                {
+                    m_failed = true;
+                    break;
+                }
+
+                unsigned from = lo.first();
+                unsigned to = hi.first();
+
+                // std::regex compares plain chars, which are signed for bytes
+                // above 0x7f, so only ASCII ranges are compiled.
+                if (from > to || to > 0x7f)
+                    m_failed = true;
+
+                set |= ByteSet::range(from, to);
+            }
+            else
+                set |= lo;
+        }
+
+        if (at_end())
+            m_failed = true;
+        else
+            m_pos++;
+
+        return negate ? ~set : set;
+    }
+
+    constexpr ByteSet parse_class_atom()
+    {
+        char c = peek();
+        m_pos++;
+
+        if (c == '\\')
+            return parse_escape(true);
+
+        // POSIX classes such as [:alpha:] are left to std::regex.
+        if (c == '[' && !at_end() &&
+            (peek() == ':' || peek() == '.' || peek() == '='))
+            m_failed = true;
+
+        return single(static_cast<unsigned char>(c));
+    }
+};
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "arena.hpp"
+#include "token.hpp"
+
+/**
+ * @brief The ID of an interned identifier; see SymbolTable.
+ */
+struct Symbol
+{
+    std::uint32_t id;
+};
+
+/**
+ * @brief The value a pipeline stage attached to a token: nothing, the symbol
+ * of an identifier, or the number a literal denotes.
+ */
+using TokenValue = std::variant<std::monostate, Symbol, std::int64_t, double>;
+
+/**
+ * @brief A token as it flows through a Pipeline, with the value its stages
+ * attached to it.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ * @tparam Lexeme The type holding the matched text.
+ */
+template <typename TokenType, typename Lexeme = std::string>
+struct ValuedToken : Token<TokenType, Lexeme>
+{
+    TokenValue value = {};
+};
+
+/**
+ * @brief Maps identifiers to small IDs that stay the same for as long as the
+ * table lives, so that later stages compare and hash integers instead of
+ * strings.
+ *
+ * The names are copied into a TokenArena, and the views name() returns stay
+ * valid until clear(). Interning a name seen before only looks it up; a new
+ * name allocates a hash map node, and at times grows the arena or the list of
+ * names.
+ */
+class SymbolTable
+{
+  public:
+    /**
+     * @brief Returns the ID of a name, adding the name if it is new.
+     *
+     * @param name The name.
+     * @return The ID, the number of distinct names interned before it.
+     */
+    std::uint32_t intern(std::string_view name)
+    {
+        auto it = m_ids.find(name);
+
+        if (it != m_ids.end())
+            return it->second;
+
+        auto id = static_cast<std::uint32_t>(m_names.size());
+        std::string_view copy = m_storage.copy(name);
+
+        m_names.push_back(copy);
+        m_ids.emplace(copy, id);
+
+        return id;
+    }
+
+    /// @brief The name of an ID returned by intern().
+    std::string_view name(std::uint32_t id) const { return m_names[id]; }
+
+    /// @brief The name of a symbol.
+    std::string_view name(Symbol symbol) const { return m_names[symbol.id]; }
+
+    /// @brief The number of distinct names.
+    std::size_t size() const { return m_names.size(); }
+
+    /**
+     * @brief Forgets every name; the IDs start from 0 again.
+     */
+    void clear()
+    {
+        m_ids.clear();
+        m_names.clear();
+        m_storage.reset();
+    }
+
+  private:
+    TokenArena m_storage;
+    std::vector<std::string_view> m_names;
+    std::unordered_map<std::string_view, std::uint32_t> m_ids;
+};
+
+/**
+ * @brief A pipeline stage that drops the tokens of some types.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ */
+template <typename TokenType>
+class TypeFilter
+{
+  public:
+    /**
+     * @param types The types to drop.
+     */
+    explicit TypeFilter(std::vector<TokenType> types)
+        : m_types(std::move(types))
+    {}
+
+    template <typename Lexeme>
+    bool operator()(ValuedToken<TokenType, Lexeme>& token) const
+    {
+        return std::find(m_types.begin(), m_types.end(), token.type) ==
+               m_types.end();
+    }
+
+  private:
+    std::vector<TokenType> m_types;
+};
+
+/**
+ * @brief A pipeline stage that interns the lexemes of some types into a
+ * SymbolTable, and attaches the Symbol to the token.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ */
+template <typename TokenType>
+class Interner
+{
+  public:
+    /**
+     * @param table The table to intern into. It must outlive the stage.
+     * @param types The types of the tokens to intern, such as identifiers.
+     */
+    Interner(SymbolTable& table, std::vector<TokenType> types)
+        : m_table(&table)
+        , m_types(std::move(types))
+    {}
+
+    template <typename Lexeme>
+    bool operator()(ValuedToken<TokenType, Lexeme>& token) const
+    {
+        if (std::find(m_types.begin(), m_types.end(), token.type) !=
+            m_types.end())
+            token.value = Symbol{m_table->intern(token.lexeme)};
+
+        return true;
+    }
+
+  private:
+    SymbolTable* m_table;
+    std::vector<TokenType> m_types;
+};
+
+/**
+ * @brief A pipeline stage that parses the lexemes of numeric literals with
+ * std::from_chars, and attaches the number to the token.
+ *
+ * Integers are parsed in base 10 into a std::int64_t, and floating-point
+ * literals into a double. A lexeme that does not parse as a whole, or whose
+ * value is out of range, keeps no value.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ */
+template <typename TokenType>
+class NumberParser
+{
+  public:
+    /**
+     * @param integers The types of integer literals.
+     * @param floats The types of floating-point literals.
+     */
+    NumberParser(std::vector<TokenType> integers,
+                 std::vector<TokenType> floats)
+        : m_integers(std::move(integers))
+        , m_floats(std::move(floats))
+    {}
+
+    template <typename Lexeme>
+    bool operator()(ValuedToken<TokenType, Lexeme>& token) const
+    {
+        if (std::find(m_integers.begin(), m_integers.end(), token.type) !=
+            m_integers.end())
+            parse<std::int64_t>(token);
+        else if (std::find(m_floats.begin(), m_floats.end(), token.type) !=
+                 m_floats.end())
+            parse<double>(token);
+
+        return true;
+    }
+
+  private:
+    std::vector<TokenType> m_integers;
+    std::vector<TokenType> m_floats;
+
+    template <typename Number, typename Lexeme>
+    static void parse(ValuedToken<TokenType, Lexeme>& token)
+    {
+        const char* begin = token.lexeme.data();
+        const char* end = begin + token.lexeme.size();
+        Number number;
+        auto [last, error] = std::from_chars(begin, end, number);
+
+        if (error == std::errc() && last == end)
+            token.value = number;
+    }
+};
+
+/**
+ * @brief Stages run in order on every token as the lexer produces it, so that
+ * filtering and converting tokens takes no pass over the input of its own.
+ *
+ * A stage is any callable taking a ValuedToken by reference, which it may
+ * change, and returning false to drop the token; the stages after it then do
+ * not see it. A pipeline is itself a stage, so pipelines nest.
+ *
+ * Run one with Lexer::tokenize_into().
+ *
+ * @tparam Stages The types of the stages.
+ */
+template <typename... Stages>
+class Pipeline
+{
+  public:
+    explicit Pipeline(Stages... stages)
+        : m_stages(std::move(stages)...)
+    {}
+
+    template <typename TokenType, typename Lexeme>
+    bool operator()(ValuedToken<TokenType, Lexeme>& token)
+    {
+        return std::apply([&](auto&... stage) { return (stage(token) && ...); },
+                          m_stages);
+    }
+
+  private:
+    std::tuple<Stages...> m_stages;
+};
+
+/**
+ * @brief Builds a Pipeline from its stages, in the order they run.
+ */
+template <typename... Stages>
+Pipeline<std::decay_t<Stages>...> make_pipeline(Stages&&... stages)
+{
+    return Pipeline<std::decay_t<Stages>...>(
+        std::forward<Stages>(stages)...);
+}
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dfa.hpp"
+#include "magic_enum/magic_enum.hpp"
+#include "rule_set.hpp"
+
+/**
+ * @brief The default profiling policy of a Lexer, which records nothing.
+ *
+ * Every hook is empty and inline, so a lexer built with it compiles to the
+ * same code as one without any instrumentation.
+ */
+struct NullProfiler
+{
+    /// @brief The value taken before a match and handed back to record().
+    struct Mark
+    {};
+
+    /// @brief Called right before the rule set is matched at a position.
+    Mark start() const { return {}; }
+
+    /// @brief Called with the result of the match at a position.
+    template <typename TokenType>
+    void record(const RuleSet<TokenType>&,
+                LexerMode,
+                const char*,
+                const char*,
+                const Dfa::Match&,
+                Mark)
+    {}
+};
+
+/**
+ * @brief A profiling policy that records, for every definition of the rule
+ * set, how often it is tried, matches and wins, and how long it takes.
+ *
+ * Only the definitions of the mode the lexer is in are tried and counted.
+ *
+ * The rule set matches every definition in a single pass, so the cost of one
+ * definition cannot be observed there. At every position the profiler
+ * therefore also matches each definition on its own, with a rule set compiled
+ * from that definition alone, and times it; this shows which definitions are
+ * expensive or ambiguous, but makes a profiled run several times slower than
+ * the lexer it profiles.
+ *
+ * Use it as the Profiler parameter of a Lexer, and read it back with
+ * Lexer::profiler() after the run.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ */
+template <typename TokenType>
+class RuleProfiler
+{
+  public:
+    using clock = std::chrono::steady_clock;
+    using Mark = clock::time_point;
+
+    /**
+     * @brief The counters of one definition.
+     */
+    struct RuleStats
+    {
+        TokenType type;
+        std::string pattern;
+        /// @brief Positions at which the definition got past the first byte,
+        /// that is where it still had to be followed after one byte.
+        std::size_t attempts = 0;
+        /// @brief Positions at which the definition matched, winning or not.
+        std::size_t matches = 0;
+        /// @brief Positions at which the definition produced the token.
+        std::size_t wins = 0;
+        /// @brief The bytes of the tokens the definition produced.
+        std::size_t bytes = 0;
+        /// @brief The time spent matching the definition on its own.
+        clock::duration time = {};
+    };
+
+    Mark start() const { return clock::now(); }
+
+    /**
+     * @brief Records the match at a position.
+     *
+     * @param rules The rule set that was matched.
+     * @param mode The mode it was matched in.
+     * @param begin The position.
+     * @param end The end of the input.
+     * @param match The result of the rule set.
+     * @param start The mark taken before the rule set was matched.
+     */
+    void record(const RuleSet<TokenType>& rules,
+                LexerMode mode,
+                const char* begin,
+                const char* end,
+                const Dfa::Match& match,
+                Mark start)
+    {
+        m_match_time += clock::now() - start;
+
+        if (m_source != &rules)
+            prepare(rules);
+
+        std::size_t fan_out = 0;
+
+        for (std::size_t i = 0; i < m_rules.size(); i++)
+        {
+            if (rules.definitions()[i].mode != mode)
+                continue;
+
+            Mark before = clock::now();
+            Dfa::Match single = m_singles[i].match(begin, end);
+            m_rules[i].time += clock::now() - before;
+
+            if (single.length > 0 || single.scanned > 1)
+            {
+                m_rules[i].attempts++;
+                fan_out++;
+            }
+
+            if (single.length > 0)
+                m_rules[i].matches++;
+        }
+
+        if (match.length > 0)
+        {
+            m_rules[match.rule].wins++;
+            m_rules[match.rule].bytes += match.length;
+        }
+
+        if (m_fan_out.size() <= fan_out)
+            m_fan_out.resize(fan_out + 1);
+
+        m_fan_out[fan_out]++;
+        m_positions++;
+    }
+
+    /// @brief The counters of every definition, in priority order.
+    const std::vector<RuleStats>& rules() const { return m_rules; }
+
+    /// @brief How many positions had a given number of definitions past
+    /// their first byte, indexed by that number.
+    const std::vector<std::size_t>& fan_out() const { return m_fan_out; }
+
+    /// @brief The number of positions the rule set was matched at.
+    std::size_t positions() const { return m_positions; }
+
+    /// @brief The time spent matching the rule set itself.
+    clock::duration match_time() const { return m_match_time; }
+
+    /**
+     * @brief Clears every counter, keeping the compiled definitions.
+     */
+    void reset()
+    {
+        for (auto& rule : m_rules)
+            rule = {rule.type, rule.pattern};
+
+        m_fan_out.clear();
+        m_positions = 0;
+        m_match_time = {};
+    }
+
+    /**
+     * @brief Writes the counters as a table, one definition per row.
+     *
+     * The formatting state of the stream is restored afterwards.
+     *
+     * @param out The stream to write to.
+     */
+    void write_table(std::ostream& out) const
+    {
+        std::ios_base::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        char fill = out.fill();
+        std::size_t width = 4;
+
+        out << std::fixed << std::setprecision(3) << std::setfill(' ');
+
+        for (const auto& rule : m_rules)
+            width = std::max(width, magic_enum::enum_name(rule.type).size());
+
+        out << std::left << std::setw(width) << "rule" << std::right
+            << std::setw(12) << "attempts" << std::setw(12) << "matches"
+            << std::setw(12) << "wins" << std::setw(12) << "bytes"
+            << std::setw(12) << "time (ms)" << "  pattern\n";
+
+        for (const auto& rule : m_rules)
+            out << std::left << std::setw(width)
+                << magic_enum::enum_name(rule.type) << std::right
+                << std::setw(12) << rule.attempts << std::setw(12)
+                << rule.matches << std::setw(12) << rule.wins
+                << std::setw(12) << rule.bytes << std::setw(12)
+                << milliseconds(rule.time) << "  " << rule.pattern << "\n";
+
+        out << "\n"
+            << m_positions << " positions, "
+            << milliseconds(m_match_time) << " ms in the rule set\n"
+            << "fan-out:";
+
+        for (std::size_t i = 0; i < m_fan_out.size(); i++)
+            if (m_fan_out[i] > 0)
+                out << " " << i << ":" << m_fan_out[i];
+
+        out << "\n";
+        out.flags(flags);
+        out.precision(precision);
+        out.fill(fill);
+    }
+
+    /**
+     * @brief Writes the counters as a JSON object.
+     *
+     * @param out The stream to write to.
+     */
+    void write_json(std::ostream& out) const
+    {
+        out << "{\n  \"positions\": " << m_positions
+            << ",\n  \"match_time_ns\": " << nanoseconds(m_match_time)
+            << ",\n  \"rules\": [";
+
+        for (std::size_t i = 0; i < m_rules.size(); i++)
+        {
+            const auto& rule = m_rules[i];
+
+            out << (i ? ",\n" : "\n") << "    {\"type\": ";
+            write_string(out, magic_enum::enum_name(rule.type));
+            out << ", \"pattern\": ";
+            write_string(out, rule.pattern);
+            out << ", \"attempts\": " << rule.attempts
+                << ", \"matches\": " << rule.matches
+                << ", \"wins\": " << rule.wins << ", \"bytes\": " << rule.bytes
+                << ", \"time_ns\": " << nanoseconds(rule.time) << "}";
+        }
+
+        out << "\n  ],\n  \"fan_out\": [";
+
+        for (std::size_t i = 0; i < m_fan_out.size(); i++)
+            out << (i ? ", " : "") << m_fan_out[i];
+
+        out << "]\n}\n";
+    }
+
+  private:
+    /// @brief The rule set the definitions were compiled from.
+    const RuleSet<TokenType>* m_source = nullptr;
+    /// @brief A rule set for every definition on its own.
+    std::vector<RuleSet<TokenType>> m_singles;
+    std::vector<RuleStats> m_rules;
+    std::vector<std::size_t> m_fan_out;
+    std::size_t m_positions = 0;
+    clock::duration m_match_time = {};
+
+    /**
+     * @brief Compiles every definition of a rule set on its own, restarting
+     * the counters if they belonged to another rule set.
+     */
+    void prepare(const RuleSet<TokenType>& rules)
+    {
+        const auto& definitions = rules.definitions();
+        bool same = m_rules.size() == definitions.size();
+
+        for (std::size_t i = 0; same && i < definitions.size(); i++)
+            same = m_rules[i].type == definitions[i].type &&
+                   m_rules[i].pattern == definitions[i].pattern;
+
+        m_source = &rules;
+
+        if (same)
+            return;
+
+        m_singles.clear();
+        m_rules.clear();
+
+        for (const auto& definition : definitions)
+        {
+            m_singles.emplace_back(
+                std::vector<TokenDefinition<TokenType>>{definition.in(0)});
+            m_rules.push_back({definition.type, definition.pattern});
+        }
+
+        reset();
+    }
+
+    static double milliseconds(clock::duration time)
+    {
+        return std::chrono::duration<double, std::milli>(time).count();
+    }
+
+    static long long nanoseconds(clock::duration time)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time)
+            .count();
+    }
+
+    static void write_string(std::ostream& out, std::string_view text)
+    {
+        out << '"';
+
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escape[8];
+                std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+                out << escape;
+            }
+            else
+                out << c;
+        }
+
+        out << '"';
+    }
+};
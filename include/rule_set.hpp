@@ -0,0 +1,519 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dfa.hpp"
+#include "hash.hpp"
+#include "mapped_file.hpp"
+#include "token.hpp"
+
+/**
+ * @brief Selects the matching engine used by a RuleSet.
+ */
+enum class LexerBackend
+{
+    /**
+     * @brief Compiles every definition into one DFA, falling back to
+     * std::regex only for patterns the DFA compiler does not support.
+     *
+     * Within a single pattern the DFA always takes the longest match, whereas
+     * std::regex takes the first alternative that matches; the two only differ
+     * for patterns such as "a|ab".
+     */
+    Dfa,
+    /// @brief Runs std::regex for every definition at every position.
+    Regex,
+};
+
+/**
+ * @brief The compiled, immutable form of a set of token definitions.
+ *
+ * A RuleSet holds everything that is derived from the definitions alone and
+ * none of the state of a scan, so a single instance can be shared by any
+ * number of lexers, including lexers running on different threads.
+ *
+ * Every lexer mode gets its own automaton over the definitions active in it,
+ * so that a match only ever considers those definitions.
+ *
+ * The compiled automaton can be saved as an image, either a file or a
+ * generated header, and loaded again without compiling any pattern the DFA
+ * supports. An image records a version and a hash of the definitions it was
+ * compiled from, and is rejected if either differs.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ */
+template <typename TokenType>
+class RuleSet
+{
+  public:
+    /// @brief The signature of a matcher compiled ahead of time.
+    using Matcher = Dfa::Match (*)(const char* begin, const char* end);
+
+    /// @brief The version of the image format written by image(). Images of
+    /// any other version are rejected.
+    static constexpr std::uint32_t image_version = 2;
+
+    /**
+     * @brief Constructs a rule set without any definitions.
+     */
+    RuleSet() = default;
+
+    /**
+     * @brief Compiles a set of token definitions.
+     *
+     * @param definitions The definitions, in priority order.
+     * @param backend The matching engine to use. Defaults to the DFA.
+     */
+    RuleSet(std::vector<TokenDefinition<TokenType>> definitions,
+            LexerBackend backend = LexerBackend::Dfa)
+        : m_definitions(std::move(definitions))
+        , m_backend(backend)
+    {
+        group_modes();
+
+        for (auto& mode : m_modes)
+        {
+            if (backend != LexerBackend::Dfa)
+                continue;
+
+            std::vector<std::string> patterns;
+
+            for (auto rule : mode.rules)
+                patterns.push_back(m_definitions[rule].pattern);
+
+            mode.dfa = Dfa::compile(patterns);
+        }
+
+        compile_fallbacks();
+    }
+
+    /**
+     * @brief Wraps a matcher that was compiled ahead of time, such as
+     * StaticScanner::match(), without compiling anything at runtime.
+     *
+     * @param definitions The definitions the matcher was compiled from, in
+     * priority order.
+     * @param matcher Finds the longest match over every definition, with the
+     * same contract as match(). Every definition is taken to be in mode 0.
+     */
+    RuleSet(std::vector<TokenDefinition<TokenType>> definitions,
+            Matcher matcher)
+        : m_definitions(std::move(definitions))
+        , m_matcher(matcher)
+    {}
+
+    /// @brief The definitions, in priority order.
+    const std::vector<TokenDefinition<TokenType>>& definitions() const
+    {
+        return m_definitions;
+    }
+
+    /**
+     * @brief The number of lexer modes, one more than the highest mode any
+     * definition is in or enters. With a single mode, the mode actions of the
+     * definitions have no effect.
+     */
+    std::size_t mode_count() const
+    {
+        return m_matcher ? 1 : std::max<std::size_t>(m_modes.size(), 1);
+    }
+
+    /**
+     * @brief Serializes the compiled automaton into an image.
+     *
+     * @return The image, or an empty string for a rule set built around a
+     * matcher compiled ahead of time, which has nothing to save.
+     */
+    std::string image() const
+    {
+        if (m_matcher)
+            return {};
+
+        std::string out(image_magic, sizeof(image_magic));
+        std::uint32_t version = image_version;
+        std::uint32_t byte_order = image_byte_order;
+        std::uint64_t digest = hash(m_definitions);
+
+        out.append(reinterpret_cast<const char*>(&version), sizeof(version));
+        out.append(reinterpret_cast<const char*>(&byte_order),
+                   sizeof(byte_order));
+        out.append(reinterpret_cast<const char*>(&digest), sizeof(digest));
+
+        // Each mode's automaton is preceded by its size; the definitions of
+        // a mode follow from the definitions themselves.
+        for (const auto& mode : m_modes)
+        {
+            std::size_t at = out.size();
+            std::uint32_t size = 0;
+
+            out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+            mode.dfa.serialize(out);
+            size = static_cast<std::uint32_t>(out.size() - at - sizeof(size));
+            std::memcpy(&out[at], &size, sizeof(size));
+        }
+
+        return out;
+    }
+
+    /**
+     * @brief Writes the image to a file with replace_file(), so that a
+     * process that has the old image mapped by load_image() keeps reading it
+     * rather than a truncated file.
+     *
+     * @param filepath The path to the file.
+     * @return False if there is no image or the file could not be written.
+     */
+    bool save_image(const std::string& filepath) const
+    {
+        std::string data = image();
+
+        if (data.empty())
+            return false;
+
+        return replace_file(filepath, data);
+    }
+
+    /**
+     * @brief Writes the image as a header defining a byte array, to be loaded
+     * with from_image().
+     *
+     * @param out The stream to write the header to.
+     * @param name The name of the array.
+     * @return False if there is no image.
+     */
+    bool write_image_header(std::ostream& out, const std::string& name) const
+    {
+        std::string data = image();
+
+        if (data.empty())
+            return false;
+
+        out << "// Generated by RuleSet::write_image_header(); do not edit.\n"
+            << "#pragma once\n\n"
+            << "alignas(8) inline constexpr unsigned char " << name << "[] = {";
+
+        for (std::size_t i = 0; i < data.size(); i++)
+            out << (i % 12 ? " " : "\n    ") << "0x" << std::hex
+                << std::setw(2) << std::setfill('0')
+                << static_cast<unsigned>(static_cast<unsigned char>(data[i]))
+                << ",";
+
+        out << std::dec << std::setfill(' ') << "\n};\n";
+        return static_cast<bool>(out);
+    }
+
+    /**
+     * @brief Builds a rule set from an image without copying it.
+     *
+     * Only the definitions the DFA does not support are compiled, with
+     * std::regex.
+     *
+     * @param definitions The definitions the image was compiled from, in
+     * priority order.
+     * @param image The image, aligned to eight bytes.
+     * @param owner Keeps the memory of image alive for as long as the rule set
+     * exists; may be null if the image is static, as in a generated header.
+     * @return The rule set, or null if the image is malformed, of another
+     * version, or compiled from other definitions.
+     */
+    static std::shared_ptr<const RuleSet>
+    from_image(std::vector<TokenDefinition<TokenType>> definitions,
+               std::string_view image,
+               std::shared_ptr<const void> owner = nullptr)
+    {
+        constexpr std::size_t header = sizeof(image_magic) + 16;
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint64_t digest;
+
+        if (image.size() < header ||
+            image.compare(0, sizeof(image_magic),
+                          std::string_view(image_magic, sizeof(image_magic))))
+            return nullptr;
+
+        std::memcpy(&version, image.data() + 8, sizeof(version));
+        std::memcpy(&byte_order, image.data() + 12, sizeof(byte_order));
+        std::memcpy(&digest, image.data() + 16, sizeof(digest));
+
+        if (version != image_version || byte_order != image_byte_order ||
+            digest != hash(definitions))
+            return nullptr;
+
+        auto rules = std::make_shared<RuleSet>();
+        rules->m_definitions = std::move(definitions);
+        rules->group_modes();
+
+        std::size_t at = header;
+
+        for (auto& mode : rules->m_modes)
+        {
+            std::uint32_t size;
+
+            if (image.size() - at < sizeof(size))
+                return nullptr;
+
+            std::memcpy(&size, image.data() + at, sizeof(size));
+            at += sizeof(size);
+
+            if (image.size() - at < size)
+                return nullptr;
+
+            auto dfa = Dfa::deserialize(image.substr(at, size), owner);
+
+            // The regex backend leaves every automaton without patterns.
+            if (!dfa || (dfa->pattern_count() != mode.rules.size() &&
+                         dfa->pattern_count() != 0))
+                return nullptr;
+
+            // An image does not record its backend, but only the regex
+            // backend leaves a mode with definitions without patterns.
+            if (dfa->pattern_count() != mode.rules.size())
+                rules->m_backend = LexerBackend::Regex;
+
+            mode.dfa = std::move(*dfa);
+            at += size;
+        }
+
+        if (at != image.size())
+            return nullptr;
+
+        rules->compile_fallbacks();
+
+        return rules;
+    }
+
+    /**
+     * @brief Builds a rule set from an image file, which stays mapped for as
+     * long as the rule set exists.
+     *
+     * @param definitions The definitions the image was compiled from, in
+     * priority order.
+     * @param filepath The path to the image.
+     * @return The rule set, or null if the file cannot be read or the image is
+     * rejected by from_image().
+     */
+    static std::shared_ptr<const RuleSet>
+    load_image(std::vector<TokenDefinition<TokenType>> definitions,
+               const std::string& filepath)
+    {
+        auto file = std::make_shared<MappedFile>();
+
+        if (!file->open(filepath))
+            return nullptr;
+
+        std::string_view image = file->content();
+
+        return from_image(std::move(definitions), image, std::move(file));
+    }
+
+    /**
+     * @brief Loads an image file, or compiles the definitions and writes the
+     * image if the file is missing or stale.
+     *
+     * @param definitions The definitions, in priority order.
+     * @param filepath The path to the image.
+     * @return The rule set.
+     */
+    static std::shared_ptr<const RuleSet>
+    load_or_compile(std::vector<TokenDefinition<TokenType>> definitions,
+                    const std::string& filepath)
+    {
+        if (auto rules = load_image(definitions, filepath))
+            return rules;
+
+        auto rules = std::make_shared<const RuleSet>(std::move(definitions));
+        rules->save_image(filepath);
+
+        return rules;
+    }
+
+    /**
+     * @brief Hashes everything about a set of definitions that affects how
+     * they are compiled or matched.
+     *
+     * @param definitions The definitions, in priority order.
+     * @return The 64-bit FNV-1a hash of the definitions.
+     */
+    static std::uint64_t
+    hash(const std::vector<TokenDefinition<TokenType>>& definitions)
+    {
+        std::uint64_t digest = fnv1a_basis;
+
+        auto mix = [&](const void* data, std::size_t size)
+        { digest = fnv1a(data, size, digest); };
+
+        for (const auto& definition : definitions)
+        {
+            auto type = static_cast<std::int64_t>(definition.type);
+            std::uint64_t size = definition.pattern.size();
+
+            mix(&type, sizeof(type));
+            mix(&definition.discard, sizeof(definition.discard));
+            mix(&definition.mode, sizeof(definition.mode));
+            mix(&definition.action, sizeof(definition.action));
+            mix(&definition.target, sizeof(definition.target));
+            mix(&size, sizeof(size));
+            mix(definition.pattern.data(), definition.pattern.size());
+        }
+
+        return digest;
+    }
+
+    /**
+     * @brief Hashes the definitions together with how the rule set was built,
+     * so that the digest differs between rule sets that may produce different
+     * tokens for the same input.
+     *
+     * The DFA and regex backends differ for patterns such as "a|ab", and a
+     * matcher compiled ahead of time is not checked against either, so each
+     * gets its own digest for the same definitions.
+     *
+     * @return The 64-bit FNV-1a hash of the definitions and the engine.
+     */
+    std::uint64_t digest() const
+    {
+        auto engine = static_cast<std::uint8_t>(
+            m_matcher ? 2 : m_backend == LexerBackend::Dfa ? 0 : 1);
+
+        return fnv1a(&engine, sizeof(engine), hash(m_definitions));
+    }
+
+    /**
+     * @brief Finds the longest prefix of [begin, end) matched by any
+     * definition, preferring the definition listed first among equally long
+     * matches.
+     *
+     * @param begin The start of the input.
+     * @param end The end of the input.
+     * @param mode The lexer mode whose definitions are matched.
+     * @return The match, whose rule is an index into definitions(), or a zero
+     * length if no definition matches.
+     */
+    Dfa::Match
+    match(const char* begin, const char* end, LexerMode mode = 0) const
+    {
+        if (m_matcher)
+            return mode == 0 ? m_matcher(begin, end)
+                             : Dfa::Match{0, Dfa::no_rule};
+
+        if (mode >= m_modes.size())
+            return {0, Dfa::no_rule};
+
+        const Mode& rules = m_modes[mode];
+        Dfa::Match best = rules.dfa.match(begin, end);
+
+        if (best.rule != Dfa::no_rule)
+            best.rule = rules.rules[best.rule];
+
+        // std::regex does not tell how far it looked ahead, so the result
+        // may depend on everything up to the end.
+        if (!rules.fallback.empty())
+            best.scanned = static_cast<std::size_t>(end - begin) + 1;
+
+        for (const auto& [index, regex] : rules.fallback)
+        {
+            std::cmatch match;
+
+            if (!std::regex_search(begin, end, match, regex,
+                                   std::regex_constants::match_continuous))
+                continue;
+
+            auto length = static_cast<std::size_t>(match.length());
+            bool hit_end = best.hit_end || begin + length == end;
+
+            if (length > best.length ||
+                (length == best.length && index < best.rule))
+            {
+                best.length = length;
+                best.rule = static_cast<std::uint32_t>(index);
+            }
+
+            best.hit_end = hit_end;
+        }
+
+        return best;
+    }
+
+  private:
+    /// @brief The first bytes of every image.
+    static constexpr char image_magic[8] = {'L', 'E', 'X', 'R',
+                                            'U', 'L', 'E', 'S'};
+    /// @brief Reads differently on a host of the other byte order.
+    static constexpr std::uint32_t image_byte_order = 0x01020304;
+
+    /**
+     * @brief A definition matched with std::regex instead of the DFA.
+     */
+    struct Fallback
+    {
+        std::size_t index;
+        std::regex regex;
+    };
+
+    /**
+     * @brief The compiled definitions of one lexer mode.
+     */
+    struct Mode
+    {
+        /// @brief The automaton matching every definition it could compile.
+        Dfa dfa;
+        /// @brief The index into m_definitions of each pattern of dfa.
+        std::vector<std::uint32_t> rules;
+        /// @brief The definitions the DFA could not compile.
+        std::vector<Fallback> fallback;
+    };
+
+    /// @brief The set of rules for identifying tokens.
+    std::vector<TokenDefinition<TokenType>> m_definitions;
+    /// @brief The compiled definitions of every mode, indexed by mode.
+    std::vector<Mode> m_modes;
+    /// @brief The backend the definitions were compiled with.
+    LexerBackend m_backend = LexerBackend::Dfa;
+    /// @brief The matcher compiled ahead of time, used instead of m_modes.
+    Matcher m_matcher = nullptr;
+
+    /**
+     * @brief Creates every mode and lists the definitions active in it.
+     */
+    void group_modes()
+    {
+        std::size_t count = 1;
+
+        for (const auto& definition : m_definitions)
+        {
+            count = std::max<std::size_t>(count, definition.mode + 1);
+
+            if (definition.action == ModeAction::Push)
+                count = std::max<std::size_t>(count, definition.target + 1);
+        }
+
+        m_modes.assign(count, {});
+
+        for (std::size_t i = 0; i < m_definitions.size(); i++)
+            m_modes[m_definitions[i].mode].rules.push_back(
+                static_cast<std::uint32_t>(i));
+    }
+
+    /**
+     * @brief Compiles every definition the DFA left out with std::regex.
+     */
+    void compile_fallbacks()
+    {
+        for (auto& mode : m_modes)
+            for (std::size_t k = 0; k < mode.rules.size(); k++)
+                if (!mode.dfa.compiled(k))
+                    mode.fallback.push_back(
+                        {mode.rules[k],
+                         std::regex(m_definitions[mode.rules[k]].pattern)});
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) &&         \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define LEXER_HAS_X86_SIMD 1
+#else
+#define LEXER_HAS_X86_SIMD 0
+#endif
+
+/**
+ * @brief A set of bytes made of at most four contiguous ranges, such as the
+ * bytes of whitespace, digits or identifiers.
+ *
+ * Sets of this shape can be tested sixteen or thirty-two bytes at a time with
+ * one unsigned comparison per range.
+ */
+struct ByteRanges
+{
+    /// @brief The largest number of ranges a set may consist of.
+    static constexpr int max_ranges = 4;
+
+    /// @brief The number of ranges.
+    int count = 0;
+    /// @brief The first byte of each range.
+    std::uint8_t lo[max_ranges] = {};
+    /// @brief The last byte minus the first byte of each range.
+    std::uint8_t span[max_ranges] = {};
+    /// @brief The membership of every byte, for the scalar loop.
+    bool table[256] = {};
+};
+
+/**
+ * @brief Skips bytes in a set one at a time.
+ *
+ * @return The first byte in [it, end) that is not in the set, or end.
+ */
+inline const char*
+skip_bytes_scalar(const ByteRanges& set, const char* it, const char* end)
+{
+    while (it != end && set.table[static_cast<unsigned char>(*it)])
+        ++it;
+
+    return it;
+}
+
+#if LEXER_HAS_X86_SIMD
+
+/**
+ * @brief Skips bytes in a set sixteen at a time with SSE2.
+ *
+ * @return The first byte in [it, end) that is not in the set, or end.
+ */
+inline const char*
+skip_bytes_sse2(const ByteRanges& set, const char* it, const char* end)
+{
+    __m128i lo[ByteRanges::max_ranges];
+    __m128i span[ByteRanges::max_ranges];
+
+    for (int k = 0; k < set.count; k++)
+    {
+        lo[k] = _mm_set1_epi8(static_cast<char>(set.lo[k]));
+        span[k] = _mm_set1_epi8(static_cast<char>(set.span[k]));
+    }
+
+    while (end - it >= 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+        __m128i in = _mm_setzero_si128();
+
+        // A byte is in [lo, lo + span] iff min(byte - lo, span) == byte - lo
+        // in unsigned arithmetic.
+        for (int k = 0; k < set.count; k++)
+        {
+            __m128i offset = _mm_sub_epi8(bytes, lo[k]);
+            in = _mm_or_si128(
+                in, _mm_cmpeq_epi8(_mm_min_epu8(offset, span[k]), offset));
+        }
+
+        unsigned outside = ~_mm_movemask_epi8(in) & 0xffffu;
+
+        if (outside)
+            return it + __builtin_ctz(outside);
+
+        it += 16;
+    }
+
+    return skip_bytes_scalar(set, it, end);
+}
+
+/**
+ * @brief Skips bytes in a set thirty-two at a time with AVX2.
+ *
+ * @return The first byte in [it, end) that is not in the set, or end.
+ */
+__attribute__((target("avx2"))) inline const char*
+skip_bytes_avx2(const ByteRanges& set, const char* it, const char* end)
+{
+    __m256i lo[ByteRanges::max_ranges];
+    __m256i span[ByteRanges::max_ranges];
+
+    for (int k = 0; k < set.count; k++)
+    {
+        lo[k] = _mm256_set1_epi8(static_cast<char>(set.lo[k]));
+        span[k] = _mm256_set1_epi8(static_cast<char>(set.span[k]));
+    }
+
+    while (end - it >= 32)
+    {
+        __m256i bytes =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it));
+        __m256i in = _mm256_setzero_si256();
+
+        for (int k = 0; k < set.count; k++)
+        {
+            __m256i offset = _mm256_sub_epi8(bytes, lo[k]);
+            in = _mm256_or_si256(
+                in,
+                _mm256_cmpeq_epi8(_mm256_min_epu8(offset, span[k]), offset));
+        }
+
+        unsigned outside = ~static_cast<unsigned>(_mm256_movemask_epi8(in));
+
+        if (outside)
+            return it + __builtin_ctz(outside);
+
+        it += 32;
+    }
+
+    return skip_bytes_sse2(set, it, end);
+}
+
+#endif
+
+/// @brief The signature shared by the skip_bytes kernels.
+using SkipBytesKernel = const char* (*)(const ByteRanges&,
+                                        const char*,
+                                        const char*);
+
+/**
+ * @brief Picks the widest skip_bytes kernel the running CPU supports.
+ */
+inline SkipBytesKernel select_skip_bytes_kernel()
+{
+#if LEXER_HAS_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return skip_bytes_avx2;
+
+    return skip_bytes_sse2;
+#else
+    return skip_bytes_scalar;
+#endif
+}
+
+/**
+ * @brief Skips every byte in a set.
+ *
+ * The first byte is tested on its own, so that the common case of a run of
+ * length zero does not pay for a vector load.
+ *
+ * @param set The bytes to skip.
+ * @param it The start of the input.
+ * @param end The end of the input.
+ * @return The first byte in [it, end) that is not in the set, or end.
+ */
+inline const char*
+skip_bytes(const ByteRanges& set, const char* it, const char* end)
+{
+    static const SkipBytesKernel kernel = select_skip_bytes_kernel();
+
+    if (it == end || !set.table[static_cast<unsigned char>(*it)])
+        return it;
+
+    return kernel(set, it + 1, end);
+}
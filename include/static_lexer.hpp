@@ -0,0 +1,407 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "dfa.hpp"
+#include "pattern.hpp"
+#include "rule_set.hpp"
+#include "simd.hpp"
+#include "token.hpp"
+
+/**
+ * @brief A token definition that can be written in a constant expression.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ */
+template <typename TokenType>
+struct StaticTokenDefinition
+{
+    /// @brief The type of the token this definition creates.
+    TokenType type;
+    /// @brief The regular expression used to match this token.
+    const char* pattern;
+    /// @brief A flag indicating if matched tokens should be discarded.
+    bool discard = false;
+};
+
+/**
+ * @brief The tables of a DFA compiled in a constant expression.
+ *
+ * The layout follows Dfa, with every dimension fixed at compile time.
+ *
+ * @tparam States The number of states, including the dead state.
+ * @tparam Classes The number of byte classes.
+ * @tparam Runs The number of distinct byte sets states loop on.
+ */
+template <std::size_t States, std::size_t Classes, std::size_t Runs>
+struct StaticDfaTable
+{
+    /// @brief The narrowest integer type that holds every state.
+    using state_t = std::conditional_t<
+        (States <= 256),
+        std::uint8_t,
+        std::conditional_t<(States <= 65536), std::uint16_t, std::uint32_t>>;
+
+    /// @brief Maps every byte to its equivalence class.
+    std::uint8_t classes[256] = {};
+    state_t start = 0;
+    /// @brief Row-major transition table indexed by state and byte class.
+    state_t transitions[States * Classes] = {};
+    /// @brief The pattern accepted by each state, or Dfa::no_rule.
+    std::uint32_t accept[States] = {};
+    /// @brief The index into run_sets of the bytes each state loops on, or
+    /// UINT32_MAX.
+    std::uint32_t runs[States] = {};
+    /// @brief The distinct byte sets states loop on.
+    ByteRanges run_sets[Runs > 0 ? Runs : 1] = {};
+};
+
+/**
+ * @brief The compile-time counterpart of Dfa::compile().
+ *
+ * Only holds the functions StaticScanner evaluates while computing its tables.
+ *
+ * @tparam Rules A type with a static constexpr array of StaticTokenDefinition
+ * called `definitions`.
+ */
+template <typename Rules>
+class StaticDfaCompiler
+{
+  public:
+    /// @brief The number of definitions.
+    static constexpr std::size_t rule_count = std::size(Rules::definitions);
+
+    /**
+     * @brief The NFA of every definition.
+     *
+     * @tparam Capacity The number of states that can be stored.
+     */
+    template <std::size_t Capacity>
+    struct Nfa
+    {
+        StaticNfa<Capacity> states;
+        std::uint32_t start = 0;
+        /// @brief The first definition NfaBuilder rejected, or rule_count.
+        std::size_t unsupported = rule_count;
+    };
+
+    /**
+     * @brief The dimensions of the compiled DFA.
+     */
+    struct Shape
+    {
+        std::size_t states = 0;
+        std::size_t classes = 0;
+        std::size_t runs = 0;
+        /// @brief Whether the DFA has more states than the compiler allowed.
+        bool overflow = false;
+    };
+
+    template <std::size_t Capacity>
+    static constexpr Nfa<Capacity> build_nfa()
+    {
+        Nfa<Capacity> nfa;
+        NfaBuilder<StaticNfa<Capacity>> builder(nfa.states);
+
+        nfa.start = builder.start();
+
+        for (std::size_t rule = 0; rule < rule_count; rule++)
+        {
+            const char* pattern = Rules::definitions[rule].pattern;
+
+            if (!builder.add_pattern(pattern,
+                                     std::char_traits<char>::length(pattern),
+                                     static_cast<std::uint32_t>(rule)) &&
+                nfa.unsupported == rule_count)
+                nfa.unsupported = rule;
+        }
+
+        return nfa;
+    }
+
+    /**
+     * @brief Runs the subset construction over an NFA.
+     *
+     * @tparam MaxStates The largest number of DFA states to build.
+     * @param nfa The NFA of every definition.
+     * @param table Receives the tables, or nullptr to only measure them.
+     * @return The dimensions of the DFA.
+     */
+    template <std::size_t MaxStates, std::size_t Size, typename Table>
+    static constexpr Shape subset_construction(const Nfa<Size>& nfa,
+                                               Table* table)
+    {
+        constexpr std::size_t words = (Size + 63) / 64;
+
+        Shape shape;
+        std::uint8_t classes[256] = {};
+        unsigned char representatives[256] = {};
+        std::uint64_t sets[MaxStates][words] = {};
+        std::uint64_t next[words] = {};
+        std::uint32_t row[256] = {};
+        std::uint32_t pending[Size] = {};
+
+        shape.classes = Dfa::byte_classes(nfa.states, classes);
+
+        for (unsigned c = 256; c-- > 0;)
+            representatives[classes[c]] = static_cast<unsigned char>(c);
+
+        if (table)
+            for (unsigned c = 0; c < 256; c++)
+                table->classes[c] = classes[c];
+
+        auto closure = [&]()
+        {
+            std::size_t count = 0;
+
+            for (std::size_t w = 0; w < words; w++)
+                for (std::uint64_t bits = next[w]; bits; bits &= bits - 1)
+                    pending[count++] = static_cast<std::uint32_t>(
+                        w * 64 + __builtin_ctzll(bits));
+
+            while (count > 0)
+            {
+                std::uint32_t state = pending[--count];
+
+                for (std::uint32_t target : nfa.states[state].epsilon)
+                {
+                    if (target == NfaState::none ||
+                        ((next[target / 64] >> (target % 64)) & 1))
+                        continue;
+
+                    next[target / 64] |= std::uint64_t(1) << (target % 64);
+                    pending[count++] = target;
+                }
+            }
+        };
+
+        auto intern = [&]() -> std::uint32_t
+        {
+            for (std::size_t id = 0; id < shape.states; id++)
+            {
+                bool equal = true;
+
+                for (std::size_t w = 0; w < words && equal; w++)
+                    equal = sets[id][w] == next[w];
+
+                if (equal)
+                    return static_cast<std::uint32_t>(id);
+            }
+
+            if (shape.states == MaxStates)
+            {
+                shape.overflow = true;
+                return 0;
+            }
+
+            for (std::size_t w = 0; w < words; w++)
+                sets[shape.states][w] = next[w];
+
+            return static_cast<std::uint32_t>(shape.states++);
+        };
+
+        // The empty set of NFA states is the dead state.
+        intern();
+
+        next[nfa.start / 64] |= std::uint64_t(1) << (nfa.start % 64);
+        closure();
+
+        std::uint32_t start = intern();
+
+        if (table)
+            table->start = static_cast<typename Table::state_t>(start);
+
+        for (std::size_t id = 0; id < shape.states && !shape.overflow; id++)
+        {
+            std::uint32_t rule = Dfa::no_rule;
+
+            for (std::size_t w = 0; w < words; w++)
+                for (std::uint64_t bits = sets[id][w]; bits; bits &= bits - 1)
+                    rule = std::min(
+                        rule, nfa.states[w * 64 + __builtin_ctzll(bits)].rule);
+
+            for (std::size_t cls = 0; cls < shape.classes; cls++)
+            {
+                for (std::size_t w = 0; w < words; w++)
+                    next[w] = 0;
+
+                for (std::size_t w = 0; w < words; w++)
+                {
+                    for (std::uint64_t bits = sets[id][w]; bits;
+                         bits &= bits - 1)
+                    {
+                        std::size_t state = w * 64 + __builtin_ctzll(bits);
+                        const NfaState& from = nfa.states[state];
+
+                        if (from.next != NfaState::none &&
+                            from.set.test(representatives[cls]))
+                            next[from.next / 64] |= std::uint64_t(1)
+                                                    << (from.next % 64);
+                    }
+                }
+
+                closure();
+                row[cls] = intern();
+            }
+
+            ByteRanges run;
+            bool has_run = id != Dfa::dead_state &&
+                           Dfa::find_run(row, classes,
+                                         static_cast<std::uint32_t>(id), run);
+
+            if (table)
+            {
+                for (std::size_t cls = 0; cls < shape.classes; cls++)
+                    table->transitions[id * shape.classes + cls] =
+                        static_cast<typename Table::state_t>(row[cls]);
+
+                table->accept[id] = rule;
+                table->runs[id] =
+                    has_run ? static_cast<std::uint32_t>(shape.runs)
+                            : UINT32_MAX;
+
+                if (has_run)
+                    table->run_sets[shape.runs] = run;
+            }
+
+            shape.runs += has_run;
+        }
+
+        return shape;
+    }
+};
+
+/**
+ * @brief A scanner whose automaton is compiled while the program is compiled.
+ *
+ * When the token definitions are fixed at build time they can be written as a
+ * constant array, and the same subset construction Dfa::compile() performs at
+ * startup runs in a constant expression instead. The tables end up in
+ * read-only data and match() is specialized on their dimensions, so there is
+ * no startup cost and the compiler sees the whole state machine.
+ *
+ * @code
+ * struct Rules
+ * {
+ *     static constexpr StaticTokenDefinition<TokenType> definitions[] = {
+ *         {TokenType::Whitespace, "\\s+", true},
+ *         {TokenType::Identifier, "[a-zA-Z_]\\w*"},
+ *     };
+ * };
+ *
+ * Lexer<TokenType> lexer(make_static_rule_set<Rules>());
+ * @endcode
+ *
+ * Every pattern must be supported by the DFA compiler, since there is no
+ * std::regex fallback at compile time; a pattern that is not fails to compile.
+ * Large rule sets may need a higher -fconstexpr-ops-limit.
+ *
+ * @tparam Rules A type with a static constexpr array of StaticTokenDefinition
+ * called `definitions`.
+ * @tparam MaxStates The largest number of DFA states the compiler builds.
+ */
+template <typename Rules, std::size_t MaxStates = 1024>
+class StaticScanner
+{
+  public:
+    using compiler_t = StaticDfaCompiler<Rules>;
+    /// @brief The enum type used for classifying tokens.
+    using type_t = std::remove_cv_t<decltype(Rules::definitions[0].type)>;
+
+    static constexpr std::size_t nfa_size =
+        compiler_t::template build_nfa<1>().states.size();
+    static constexpr auto nfa = compiler_t::template build_nfa<nfa_size>();
+
+    static_assert(nfa.unsupported == compiler_t::rule_count,
+                  "A pattern uses syntax the compile-time scanner does not "
+                  "support; see nfa.unsupported for its index");
+
+    static constexpr auto shape =
+        compiler_t::template subset_construction<MaxStates>(
+            nfa, static_cast<StaticDfaTable<1, 1, 1>*>(nullptr));
+
+    static_assert(!shape.overflow,
+                  "The rules compile to more DFA states than MaxStates");
+
+    using table_t = StaticDfaTable<shape.states, shape.classes, shape.runs>;
+
+    /// @brief The compiled tables.
+    static constexpr table_t table = []()
+    {
+        table_t table;
+        compiler_t::template subset_construction<shape.states>(nfa, &table);
+        return table;
+    }();
+
+    /**
+     * @brief Finds the longest prefix of [begin, end) matched by any
+     * definition, like Dfa::match().
+     */
+    static Dfa::Match match(const char* begin, const char* end)
+    {
+        Dfa::Match best = {0, Dfa::no_rule};
+        std::uint32_t state = table.start;
+        const char* it = begin;
+
+        while (it != end && state != Dfa::dead_state)
+        {
+            state = table.transitions[state * shape.classes +
+                                      table.classes[static_cast<unsigned char>(
+                                          *it)]];
+            ++it;
+
+            if constexpr (shape.runs > 0)
+                if (table.runs[state] != UINT32_MAX)
+                    it = skip_bytes(table.run_sets[table.runs[state]], it, end);
+
+            if (table.accept[state] != Dfa::no_rule)
+                best = {static_cast<std::size_t>(it - begin),
+                        table.accept[state]};
+        }
+
+        best.hit_end = state != Dfa::dead_state;
+        best.scanned = static_cast<std::size_t>(it - begin) + best.hit_end;
+
+        return best;
+    }
+
+    /**
+     * @brief The definitions as TokenDefinition values, for a RuleSet.
+     */
+    static std::vector<TokenDefinition<type_t>> definitions()
+    {
+        std::vector<TokenDefinition<type_t>> definitions;
+
+        for (const auto& definition : Rules::definitions)
+            definitions.emplace_back(definition.type, definition.pattern,
+                                     definition.discard);
+
+        return definitions;
+    }
+};
+
+/**
+ * @brief Creates a rule set that matches with a StaticScanner.
+ *
+ * The result can be used anywhere a RuleSet compiled at runtime can, such as
+ * Lexer, tokenize_files() and tokenize_parallel().
+ *
+ * @tparam Rules A type with a static constexpr array of StaticTokenDefinition
+ * called `definitions`.
+ */
+template <typename Rules>
+std::shared_ptr<const RuleSet<typename StaticScanner<Rules>::type_t>>
+make_static_rule_set()
+{
+    using scanner_t = StaticScanner<Rules>;
+
+    return std::make_shared<const RuleSet<typename scanner_t::type_t>>(
+        scanner_t::definitions(), &scanner_t::match);
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A fixed-size thread pool in which idle workers steal queued tasks
+ * from busy ones.
+ *
+ * Every worker owns a queue. Submitted tasks are spread over the queues in
+ * round-robin order; a worker runs tasks from the back of its own queue and,
+ * once that is empty, takes tasks from the front of the others. Uneven task
+ * sizes, such as files of very different lengths, are thereby balanced without
+ * a single shared queue that every worker contends on.
+ *
+ * Tasks receive the index of the worker running them, so that per-worker
+ * state can be kept in a plain vector indexed by it.
+ */
+class WorkStealingPool
+{
+  public:
+    /// @brief The signature of a task, called with the worker's index.
+    using Task = std::function<void(std::size_t worker)>;
+
+    /**
+     * @brief Starts the worker threads.
+     *
+     * @param threads The number of workers; 0 uses one per hardware thread.
+     */
+    explicit WorkStealingPool(std::size_t threads = 0)
+        : m_queued(0)
+        , m_pending(0)
+        , m_next(0)
+        , m_stop(false)
+    {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        for (std::size_t i = 0; i < threads; i++)
+            m_queues.push_back(std::make_unique<Queue>());
+
+        for (std::size_t i = 0; i < threads; i++)
+            m_threads.emplace_back([this, i] { run(i); });
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    /**
+     * @brief Finishes every submitted task and stops the workers.
+     */
+    ~WorkStealingPool()
+    {
+        wait();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+
+        m_wake.notify_all();
+
+        for (auto& thread : m_threads)
+            thread.join();
+    }
+
+    /// @brief The number of worker threads.
+    std::size_t size() const { return m_threads.size(); }
+
+    /**
+     * @brief Queues a task for execution.
+     *
+     * @param task The task to run.
+     */
+    void submit(Task task)
+    {
+        Queue& queue = *m_queues[m_next++ % m_queues.size()];
+
+        // Count the task first so that m_queued never drops below zero.
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queued++;
+            m_pending++;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+
+        m_wake.notify_one();
+    }
+
+    /**
+     * @brief Blocks until every submitted task has finished.
+     */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this] { return m_pending == 0; });
+    }
+
+  private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    /// @brief Guards the counters below and m_stop.
+    std::mutex m_mutex;
+    /// @brief Signalled when tasks are queued or the pool stops.
+    std::condition_variable m_wake;
+    /// @brief Signalled when the last pending task finishes.
+    std::condition_variable m_idle;
+    /// @brief The number of tasks waiting in a queue.
+    std::atomic<std::size_t> m_queued;
+    /// @brief The number of tasks submitted but not finished.
+    std::size_t m_pending;
+    /// @brief The queue the next task is submitted to.
+    std::atomic<std::size_t> m_next;
+    bool m_stop;
+
+    bool pop(std::size_t worker, Task& task)
+    {
+        for (std::size_t i = 0; i < m_queues.size(); i++)
+        {
+            Queue& queue = *m_queues[(worker + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+
+            if (queue.tasks.empty())
+                continue;
+
+            // The owner works LIFO for locality, thieves take the oldest task.
+            if (i == 0)
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+
+            m_queued--;
+            return true;
+        }
+
+        return false;
+    }
+
+    void run(std::size_t worker)
+    {
+        Task task;
+
+        while (true)
+        {
+            if (pop(worker, task))
+            {
+                task(worker);
+                task = nullptr;
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                if (--m_pending == 0)
+                    m_idle.notify_all();
+
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stop || m_queued > 0; });
+
+            if (m_stop && m_queued == 0)
+                return;
+        }
+    }
+};
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <ostream>
-#include <regex>
 #include <string>
+#include <string_view>
 
 #include "magic_enum/magic_enum.hpp"
 
@@ -14,18 +16,54 @@
  * that was matched, and its position in the source file.
  *
  * @tparam TokenType The enum type used for classifying tokens.
+ * @tparam Lexeme The type holding the matched text, either an owning
+ * std::string or a std::string_view into the lexer's input buffer.
  */
-template <typename TokenType>
+template <typename TokenType, typename Lexeme = std::string>
 struct Token
 {
     /// @brief The type of the token from the TokenType enum.
     TokenType type;
     /// @brief The substring from the input that matches the token's pattern.
-    std::string lexeme;
-    /// @brief The line number in the source where the token appears.
+    Lexeme lexeme;
+    /// @brief The line number in the source where the token appears, or 0 if
+    /// the lexer resolves positions lazily.
     int line;
-    /// @brief The column number in the source where the token begins.
+    /// @brief The column number in the source where the token begins, or 0 if
+    /// the lexer resolves positions lazily.
     int column;
+    /// @brief The offset of the lexeme in the input; see Lexer::position().
+    std::size_t offset = 0;
+};
+
+/**
+ * @brief A token whose lexeme is a view into the buffer it was scanned from.
+ *
+ * The view is only valid as long as that buffer is; see Lexer for the
+ * lifetime of the buffers it scans.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ */
+template <typename TokenType>
+using TokenView = Token<TokenType, std::string_view>;
+
+/**
+ * @brief Identifies a lexer mode, the set of definitions active at a point of
+ * the input. Mode 0 is the mode a scan starts in.
+ */
+using LexerMode = std::uint32_t;
+
+/**
+ * @brief What a definition does to the lexer's mode stack once it matched.
+ */
+enum class ModeAction
+{
+    /// @brief Stays in the current mode.
+    None,
+    /// @brief Enters the definition's target mode.
+    Push,
+    /// @brief Returns to the mode the current one was entered from.
+    Pop,
 };
 
 /**
@@ -35,6 +73,20 @@ struct Token
  * for matching a specific type of token, including the regular expression
  * to match and whether the token should be kept or discarded (e.g., whitespace).
  *
+ * A definition is only active in its mode, and may enter or leave a mode
+ * once it matched, so that the contents of strings or comments can be
+ * scanned by their own rules:
+ * @code
+ * enum Mode : LexerMode { Code, String };
+ *
+ * std::vector<TokenDefinition<TokenType>> definitions = {
+ *     TokenDefinition<TokenType>(TokenType::StringBegin, "\"").push(String),
+ *     TokenDefinition<TokenType>(TokenType::Text, "[^\"\\\\]+|\\\\.")
+ *         .in(String),
+ *     TokenDefinition<TokenType>(TokenType::StringEnd, "\"").in(String).pop(),
+ * };
+ * @endcode
+ *
  * @tparam TokenType The enum type used for classifying tokens.
  */
 template <typename TokenType>
@@ -51,16 +103,62 @@ struct TokenDefinition
                                const std::string regex,
                                bool discard = false)
         : type(type)
-        , regex(std::regex(regex))
+        , pattern(regex)
         , discard(discard)
     {}
 
     /// @brief The type of the token this definition creates.
     TokenType type;
-    /// @brief The compiled regular expression for matching.
-    std::regex regex;
+    /// @brief The source text of the regular expression, compiled by RuleSet.
+    std::string pattern;
     /// @brief A flag indicating if matched tokens should be discarded.
     bool discard;
+    /// @brief The mode the definition is active in.
+    LexerMode mode = 0;
+    /// @brief What the definition does to the mode stack once it matched.
+    ModeAction action = ModeAction::None;
+    /// @brief The mode entered by ModeAction::Push.
+    LexerMode target = 0;
+
+    /**
+     * @brief Returns a copy of the definition that is active in another mode.
+     *
+     * @param mode The mode, a LexerMode or an enumerator convertible to one.
+     */
+    template <typename Mode>
+    TokenDefinition in(Mode mode) const
+    {
+        TokenDefinition definition = *this;
+        definition.mode = static_cast<LexerMode>(mode);
+        return definition;
+    }
+
+    /**
+     * @brief Returns a copy of the definition that enters a mode once it
+     * matched.
+     *
+     * @param mode The mode, a LexerMode or an enumerator convertible to one.
+     */
+    template <typename Mode>
+    TokenDefinition push(Mode mode) const
+    {
+        TokenDefinition definition = *this;
+        definition.action = ModeAction::Push;
+        definition.target = static_cast<LexerMode>(mode);
+        return definition;
+    }
+
+    /**
+     * @brief Returns a copy of the definition that leaves the current mode
+     * once it matched.
+     */
+    TokenDefinition pop() const
+    {
+        TokenDefinition definition = *this;
+        definition.action = ModeAction::Pop;
+        definition.target = 0;
+        return definition;
+    }
 };
 
 /**
@@ -70,12 +168,14 @@ struct TokenDefinition
  * (e.g., std::cout), formatting it in a human-readable way for debugging.
  *
  * @tparam TokenType The enum type used for classifying tokens.
+ * @tparam Lexeme The type holding the matched text.
  * @param os The output stream to write to.
  * @param token The Token object to output.
  * @return A reference to the output stream.
  */
-template <typename TokenType>
-std::ostream& operator<<(std::ostream& os, const Token<TokenType>& token)
+template <typename TokenType, typename Lexeme>
+std::ostream& operator<<(std::ostream& os,
+                         const Token<TokenType, Lexeme>& token)
 {
     os << "Token(type: " << magic_enum::enum_name(token.type) << ", lexeme: '"
        << token.lexeme << "', line: " << token.line
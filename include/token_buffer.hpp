@@ -0,0 +1,710 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "magic_enum/magic_enum.hpp"
+#include "token.hpp"
+
+/**
+ * @brief An edit of a text: `deleted` bytes at `offset` replaced by the bytes of
+ * `inserted`.
+ */
+struct TextEdit
+{
+    /// @brief The offset the edit starts at.
+    std::size_t offset;
+    /// @brief The number of bytes removed from the old text.
+    std::size_t deleted;
+    /// @brief The text inserted in their place.
+    std::string_view inserted;
+};
+
+template <typename TokenType, typename Lexeme, typename Profiler>
+class Lexer;
+
+/**
+ * @brief An eagerly tokenized input, stored as a structure of arrays.
+ *
+ * Each token field lives in its own array: the type as a compact index into
+ * the TokenType enum, and the offset, length, line and column as integers.
+ * Passes that only look at some fields, such as filtering by type, therefore
+ * only walk the memory of those fields.
+ *
+ * The arrays are split into blocks of at most block_size tokens, whose
+ * offsets and lines are stored relative to those of the block. An edit
+ * applied by Lexer::retokenize_buffer() therefore only rewrites the blocks it
+ * touches, and shifts the tokens after them by updating one base per block.
+ *
+ * Indexing or iterating yields TokenView values built on the fly, so code
+ * written against Token mostly works unchanged. Indexing finds the block of a
+ * token with a binary search; iterating steps through the blocks in order.
+ * Lexemes are views into the source the buffer was tokenized from, which must
+ * outlive the buffer.
+ *
+ * Alongside the tokens, the buffer records how far the scan had read ahead
+ * before each token, which lets Lexer::retokenize_buffer() update it after an
+ * edit by rescanning only the tokens the edit can affect.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ */
+template <typename TokenType>
+class TokenBuffer
+{
+  public:
+    static_assert(magic_enum::enum_count<TokenType>() < 0xffff,
+                  "TokenType has too many enumerators to index in 16 bits");
+
+    /// @brief The compact integer type each token's type is stored as.
+    using type_index_t =
+        std::conditional_t<magic_enum::enum_count<TokenType>() < 0xff,
+                           std::uint8_t,
+                           std::uint16_t>;
+
+    /// @brief The index stored for a type magic_enum does not reflect, such
+    /// as an enumerator outside its range or a default
+    /// ErrorOptions::error_type when 0 is not an enumerator. The type itself
+    /// is then kept in Block::others.
+    static constexpr type_index_t other_type =
+        static_cast<type_index_t>(magic_enum::enum_count<TokenType>());
+
+    /// @brief The most tokens a block holds.
+    static constexpr std::size_t block_size = 4096;
+
+    /// @brief The Token-like value produced for every token.
+    using value_type = TokenView<TokenType>;
+
+    /**
+     * @brief A run of consecutive tokens, each field in its own array.
+     */
+    struct Block
+    {
+        /// @brief The offset of the first token in the source.
+        std::size_t offset = 0;
+        /// @brief The line number of the first token.
+        std::size_t line = 0;
+        /// @brief The type of every token, as an index into the TokenType
+        /// enum or other_type.
+        std::vector<type_index_t> types;
+        /// @brief The position and type of every token stored as
+        /// other_type, in order. Tokens of such types are rare.
+        std::vector<std::pair<std::uint32_t, TokenType>> others;
+        /// @brief The offset of every token's lexeme, from offset.
+        std::vector<std::size_t> offsets;
+        /// @brief The length of every token's lexeme.
+        std::vector<std::uint32_t> lengths;
+        /// @brief The line number of every token, from line.
+        std::vector<std::uint32_t> lines;
+        /// @brief The column number of every token.
+        std::vector<std::uint32_t> columns;
+        /// @brief The end of the source read before every token started, from
+        /// offset, or SIZE_MAX if it is unknown.
+        std::vector<std::size_t> reach;
+
+        /// @brief The number of tokens.
+        std::size_t size() const { return types.size(); }
+
+        /// @brief The type of the token at the given position.
+        TokenType type(std::size_t i) const
+        {
+            if (types[i] != other_type)
+                return magic_enum::enum_value<TokenType>(types[i]);
+
+            return std::lower_bound(others.begin(), others.end(), i,
+                                    [](const auto& other, std::size_t i)
+                                    { return other.first < i; })
+                ->second;
+        }
+    };
+
+    /**
+     * @brief A random-access iterator over the tokens of a TokenBuffer.
+     *
+     * Dereferencing yields a TokenView by value. The iterator remembers the
+     * block of the last token it yielded, so stepping through the tokens does
+     * not search for their blocks.
+     */
+    class Iterator
+    {
+      public:
+        using value_type = TokenView<TokenType>;
+        using reference = value_type;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::random_access_iterator_tag;
+
+        /**
+         * @brief Lets operator-> return a pointer to a temporary value.
+         */
+        struct pointer
+        {
+            value_type value;
+            const value_type* operator->() const { return &value; }
+        };
+
+        Iterator()
+            : m_buffer(nullptr)
+            , m_index(0)
+        {}
+
+        Iterator(const TokenBuffer* buffer, std::size_t index)
+            : m_buffer(buffer)
+            , m_index(index)
+        {}
+
+        reference operator*() const
+        {
+            const auto& starts = m_buffer->m_starts;
+
+            if (m_index < starts[m_block] || m_index >= starts[m_block + 1])
+                m_block = m_buffer->block_of(m_index);
+
+            return m_buffer->at(m_block, m_index - starts[m_block]);
+        }
+
+        pointer operator->() const { return {**this}; }
+        reference operator[](difference_type n) const
+        {
+            return (*m_buffer)[m_index + n];
+        }
+
+        Iterator& operator++()
+        {
+            m_index++;
+            return *this;
+        }
+
+        Iterator operator++(int)
+        {
+            Iterator tmp = *this;
+            m_index++;
+            return tmp;
+        }
+
+        Iterator& operator--()
+        {
+            m_index--;
+            return *this;
+        }
+
+        Iterator operator--(int)
+        {
+            Iterator tmp = *this;
+            m_index--;
+            return tmp;
+        }
+
+        Iterator& operator+=(difference_type n)
+        {
+            m_index += n;
+            return *this;
+        }
+
+        Iterator& operator-=(difference_type n)
+        {
+            m_index -= n;
+            return *this;
+        }
+
+        Iterator operator+(difference_type n) const
+        {
+            return Iterator(m_buffer, m_index + n);
+        }
+
+        Iterator operator-(difference_type n) const
+        {
+            return Iterator(m_buffer, m_index - n);
+        }
+
+        difference_type operator-(const Iterator& other) const
+        {
+            return static_cast<difference_type>(m_index) -
+                   static_cast<difference_type>(other.m_index);
+        }
+
+        bool operator==(const Iterator& other) const
+        {
+            return m_index == other.m_index;
+        }
+
+        bool operator!=(const Iterator& other) const
+        {
+            return m_index != other.m_index;
+        }
+
+        bool operator<(const Iterator& other) const
+        {
+            return m_index < other.m_index;
+        }
+
+        bool operator>(const Iterator& other) const { return other < *this; }
+        bool operator<=(const Iterator& other) const
+        {
+            return !(other < *this);
+        }
+        bool operator>=(const Iterator& other) const
+        {
+            return !(*this < other);
+        }
+
+      private:
+        const TokenBuffer* m_buffer;
+        std::size_t m_index;
+        /// @brief The block of the last token dereferenced.
+        mutable std::size_t m_block = 0;
+    };
+
+    /**
+     * @brief Constructs an empty buffer over the given source.
+     *
+     * @param source The text the tokens are taken from.
+     */
+    explicit TokenBuffer(std::string_view source = {})
+        : m_source(source)
+        , m_starts(1, 0)
+    {}
+
+    /**
+     * @brief Reserves room for a number of tokens: for their blocks, and in
+     * the arrays of the blocks started until that many tokens are stored.
+     *
+     * @param count The number of tokens.
+     */
+    void reserve(std::size_t count)
+    {
+        m_blocks.reserve(count / block_size + 1);
+        m_starts.reserve(count / block_size + 2);
+        m_reserved = std::max(m_reserved, count);
+    }
+
+    /**
+     * @brief Removes every token.
+     */
+    void clear()
+    {
+        m_blocks.clear();
+        m_starts.assign(1, 0);
+    }
+
+    /**
+     * @brief Appends a token.
+     *
+     * @param type The type of the token.
+     * @param offset The offset of the lexeme in the source.
+     * @param length The length of the lexeme.
+     * @param line The line number of the token.
+     * @param column The column number of the token.
+     * @param reach The end of the source read by the scan before the token
+     * started. Unknown by default, which makes every later edit rescan from
+     * the start.
+     */
+    void push_back(TokenType type,
+                   std::size_t offset,
+                   std::size_t length,
+                   std::size_t line,
+                   std::size_t column,
+                   std::size_t reach = SIZE_MAX)
+    {
+        if (!empty())
+            reach = std::max(reach, this->reach(size() - 1));
+
+        Entry token = {type, offset, length, line, column, reach};
+
+        if (append(m_blocks, token, block_size))
+        {
+            reserve(m_blocks.back(),
+                    std::min(block_size,
+                             m_reserved - std::min(m_reserved, size())));
+            m_starts.push_back(m_starts.back());
+        }
+
+        m_starts.back()++;
+    }
+
+    /// @brief The number of tokens.
+    std::size_t size() const { return m_starts.back(); }
+    /// @brief Whether there are no tokens.
+    bool empty() const { return size() == 0; }
+
+    /// @brief The text the tokens are taken from.
+    std::string_view source() const { return m_source; }
+
+    /// @brief The type of the token at the given index.
+    TokenType type(std::size_t index) const
+    {
+        std::size_t block = block_of(index);
+
+        return m_blocks[block].type(index - m_starts[block]);
+    }
+
+    /// @brief The lexeme of the token at the given index.
+    std::string_view lexeme(std::size_t index) const
+    {
+        return {m_source.data() + offset(index), length(index)};
+    }
+
+    /// @brief The offset of the lexeme of the token at the given index.
+    std::size_t offset(std::size_t index) const
+    {
+        return entry(index).offset;
+    }
+
+    /// @brief The length of the lexeme of the token at the given index.
+    std::size_t length(std::size_t index) const
+    {
+        return entry(index).length;
+    }
+
+    /// @brief The line number of the token at the given index.
+    std::size_t line(std::size_t index) const { return entry(index).line; }
+
+    /// @brief The column number of the token at the given index.
+    std::size_t column(std::size_t index) const
+    {
+        return entry(index).column;
+    }
+
+    /// @brief The end of the source read before the token at the given index
+    /// started, or SIZE_MAX if it is unknown; never decreases.
+    std::size_t reach(std::size_t index) const { return entry(index).reach; }
+
+    /// @brief The token at the given index.
+    value_type operator[](std::size_t index) const
+    {
+        std::size_t block = block_of(index);
+
+        return at(block, index - m_starts[block]);
+    }
+
+    Iterator begin() const { return Iterator(this, 0); }
+    Iterator end() const { return Iterator(this, size()); }
+
+    /// @brief The blocks of tokens, in order.
+    const std::vector<Block>& blocks() const { return m_blocks; }
+
+    /**
+     * @brief Converts a token type to the compact index stored in
+     * Block::types.
+     *
+     * @param type The token type.
+     * @return The index, or other_type if magic_enum does not reflect the
+     * type.
+     */
+    static type_index_t index_of(TokenType type)
+    {
+        auto index = magic_enum::enum_index(type);
+
+        return index ? static_cast<type_index_t>(*index) : other_type;
+    }
+
+  private:
+    template <typename, typename, typename>
+    friend class Lexer;
+
+    /**
+     * @brief Every field of a token, with absolute positions.
+     */
+    struct Entry
+    {
+        TokenType type;
+        std::size_t offset;
+        std::size_t length;
+        std::size_t line;
+        std::size_t column;
+        std::size_t reach;
+    };
+
+    /**
+     * @brief How the tokens after an edit move, as computed by
+     * Lexer::retokenize_buffer(). The deltas wrap around when negative.
+     */
+    struct Shift
+    {
+        /// @brief Added to every offset and known reach.
+        std::size_t offset;
+        /// @brief Added to every line number.
+        std::size_t line;
+        /// @brief Added to the column of the tokens on old_line.
+        std::size_t column;
+        /// @brief The line the first token kept was on before the edit.
+        std::size_t old_line;
+        /// @brief The least reach of the tokens kept.
+        std::size_t reach;
+    };
+
+    std::string_view m_source;
+    std::vector<Block> m_blocks;
+    /// @brief The index of the first token of every block, followed by the
+    /// number of tokens.
+    std::vector<std::size_t> m_starts;
+    /// @brief The number of tokens reserve() made room for.
+    std::size_t m_reserved = 0;
+
+    /// @brief The block holding the token at the given index.
+    std::size_t block_of(std::size_t index) const
+    {
+        return std::upper_bound(m_starts.begin(), m_starts.end(), index) -
+               m_starts.begin() - 1;
+    }
+
+    value_type at(std::size_t block, std::size_t i) const
+    {
+        const Block& b = m_blocks[block];
+        std::size_t offset = b.offset + b.offsets[i];
+
+        return {
+            .type = b.type(i),
+            .lexeme = {m_source.data() + offset, b.lengths[i]},
+            .line = static_cast<int>(b.line + b.lines[i]),
+            .column = static_cast<int>(b.columns[i]),
+            .offset = offset,
+        };
+    }
+
+    static Entry entry(const Block& block, std::size_t i)
+    {
+        return {
+            block.type(i),
+            block.offset + block.offsets[i],
+            block.lengths[i],
+            block.line + block.lines[i],
+            block.columns[i],
+            block.reach[i] == SIZE_MAX ? SIZE_MAX
+                                       : block.offset + block.reach[i],
+        };
+    }
+
+    Entry entry(std::size_t index) const
+    {
+        std::size_t block = block_of(index);
+
+        return entry(m_blocks[block], index - m_starts[block]);
+    }
+
+    static void reserve(Block& block, std::size_t count)
+    {
+        block.types.reserve(count);
+        block.offsets.reserve(count);
+        block.lengths.reserve(count);
+        block.lines.reserve(count);
+        block.columns.reserve(count);
+        block.reach.reserve(count);
+    }
+
+    /**
+     * @brief Appends a token to the last of a list of blocks, or to a new
+     * block if the last one is full.
+     *
+     * @param blocks The blocks.
+     * @param token The token.
+     * @param capacity The number of tokens a block is full at.
+     * @return Whether a new block was started.
+     */
+    static bool
+    append(std::vector<Block>& blocks, const Entry& token, std::size_t capacity)
+    {
+        bool started = blocks.empty() || blocks.back().size() == capacity;
+
+        if (started)
+        {
+            blocks.emplace_back();
+            blocks.back().offset = token.offset;
+            blocks.back().line = token.line;
+        }
+
+        Block& block = blocks.back();
+
+        type_index_t index = index_of(token.type);
+
+        if (index == other_type)
+            block.others.push_back(
+                {static_cast<std::uint32_t>(block.size()), token.type});
+
+        block.types.push_back(index);
+        block.offsets.push_back(token.offset - block.offset);
+        block.lengths.push_back(static_cast<std::uint32_t>(token.length));
+        block.lines.push_back(
+            static_cast<std::uint32_t>(token.line - block.line));
+        block.columns.push_back(static_cast<std::uint32_t>(token.column));
+        block.reach.push_back(token.reach == SIZE_MAX
+                                  ? SIZE_MAX
+                                  : token.reach - block.offset);
+
+        return started;
+    }
+
+    /**
+     * @brief The index of the first token whose reach is past a position.
+     */
+    std::size_t reach_bound(std::size_t position) const
+    {
+        auto past = [position](const Block& block, std::size_t i)
+        {
+            return block.reach[i] == SIZE_MAX ||
+                   block.offset + block.reach[i] > position;
+        };
+
+        return bound(0, past);
+    }
+
+    /**
+     * @brief The index of the first token from a given one whose offset is at
+     * or past a position.
+     */
+    std::size_t offset_bound(std::size_t from, std::size_t position) const
+    {
+        auto past = [position](const Block& block, std::size_t i)
+        { return block.offset + block.offsets[i] >= position; };
+
+        return bound(from, past);
+    }
+
+    /**
+     * @brief The index of the first token from a given one for which a
+     * predicate holds, given that it holds for every token after it.
+     */
+    template <typename Predicate>
+    std::size_t bound(std::size_t from, Predicate past) const
+    {
+        if (from >= size())
+            return size();
+
+        std::size_t first = block_of(from);
+        std::size_t block =
+            std::partition_point(m_blocks.begin() + first, m_blocks.end(),
+                                 [&](const Block& b)
+                                 { return !past(b, b.size() - 1); }) -
+            m_blocks.begin();
+
+        if (block == m_blocks.size())
+            return size();
+
+        const Block& b = m_blocks[block];
+        std::size_t start = block == first ? from - m_starts[block] : 0;
+        std::size_t i = start;
+
+        // A binary search over the indices of the block.
+        for (std::size_t count = b.size() - start; count > 0;)
+        {
+            std::size_t half = count / 2;
+
+            if (!past(b, i + half))
+            {
+                i += half + 1;
+                count -= half + 1;
+            }
+            else
+                count = half;
+        }
+
+        return m_starts[block] + i;
+    }
+
+    /**
+     * @brief Replaces the tokens [first, last) with those of another buffer
+     * and shifts the tokens from last on.
+     *
+     * Only the blocks holding first and last are rewritten, together with the
+     * next block if they would otherwise leave a block less than half full.
+     * The blocks after them only get their base offset and line shifted, and
+     * the few tokens whose column or reach changes updated in place.
+     *
+     * @param first The first token replaced.
+     * @param last One past the last token replaced.
+     * @param fresh The tokens replacing them, with their final positions.
+     * @param shift How the tokens from last on move.
+     */
+    void splice(std::size_t first,
+                std::size_t last,
+                const TokenBuffer& fresh,
+                const Shift& shift)
+    {
+        auto shifted = [&shift](Entry token)
+        {
+            if (token.line == shift.old_line)
+                token.column += shift.column;
+
+            token.offset += shift.offset;
+            token.line += shift.line;
+
+            if (token.reach != SIZE_MAX)
+                token.reach = std::max(token.reach + shift.offset, shift.reach);
+
+            return token;
+        };
+
+        std::size_t begin = first < size() ? block_of(first) : m_blocks.size();
+        std::size_t end = last < size() ? block_of(last) + 1 : m_blocks.size();
+        std::vector<Entry> tokens;
+
+        for (std::size_t i = m_starts[begin]; i < first; i++)
+            tokens.push_back(entry(m_blocks[begin], i - m_starts[begin]));
+
+        for (const Block& block : fresh.m_blocks)
+            for (std::size_t i = 0; i < block.size(); i++)
+                tokens.push_back(entry(block, i));
+
+        for (std::size_t i = last; i < m_starts[end]; i++)
+            tokens.push_back(
+                shifted(entry(m_blocks[end - 1], i - m_starts[end - 1])));
+
+        if (tokens.size() < block_size / 2 && end < m_blocks.size())
+        {
+            for (std::size_t i = 0; i < m_blocks[end].size(); i++)
+                tokens.push_back(shifted(entry(m_blocks[end], i)));
+
+            end++;
+        }
+
+        // Spread the tokens evenly, so that no block is less than half full.
+        std::size_t count = (tokens.size() + block_size - 1) / block_size;
+        std::size_t capacity = count ? (tokens.size() + count - 1) / count : 0;
+        std::vector<Block> blocks;
+
+        for (const Entry& token : tokens)
+            if (append(blocks, token, capacity))
+                reserve(blocks.back(), capacity);
+
+        m_blocks.erase(m_blocks.begin() + begin, m_blocks.begin() + end);
+        m_blocks.insert(m_blocks.begin() + begin,
+                        std::make_move_iterator(blocks.begin()),
+                        std::make_move_iterator(blocks.end()));
+        m_starts.resize(m_blocks.size() + 1);
+
+        for (std::size_t k = begin; k < m_blocks.size(); k++)
+            m_starts[k + 1] = m_starts[k] + m_blocks[k].size();
+
+        // The blocks after the rewritten ones move as a whole. Only their
+        // first tokens can be on the line the rescan ended on, or have read
+        // less than the rescan did.
+        bool settled = false;
+
+        for (std::size_t k = begin + blocks.size(); k < m_blocks.size(); k++)
+        {
+            Block& block = m_blocks[k];
+
+            block.offset += shift.offset;
+            block.line += shift.line;
+
+            for (std::size_t i = 0; i < block.size() && !settled; i++)
+            {
+                bool on_line =
+                    block.line + block.lines[i] == shift.old_line + shift.line;
+                bool behind = block.reach[i] != SIZE_MAX &&
+                              block.offset + block.reach[i] < shift.reach;
+
+                if (on_line)
+                    block.columns[i] += shift.column;
+
+                if (behind)
+                    block.reach[i] = shift.reach - block.offset;
+
+                settled = !on_line && !behind;
+            }
+        }
+    }
+};
@@ -0,0 +1,562 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "hash.hpp"
+#include "mapped_file.hpp"
+#include "token.hpp"
+
+/**
+ * @brief Hashes the text of an input, to tell whether tokens saved for it are
+ * still current.
+ *
+ * @param source The text.
+ * @return The 64-bit FNV-1a hash of the text.
+ */
+inline std::uint64_t content_hash(std::string_view source)
+{
+    return fnv1a(source.data(), source.size());
+}
+
+/**
+ * @brief The layout of a serialized token sequence, shared by TokenWriter and
+ * TokenReader.
+ *
+ * A sequence starts with a fixed header:
+ *  - the magic "LEXTOKEN", then the version and the byte order, as uint32;
+ *  - the digest of the rules the tokens were scanned with, the hash of the
+ *    source or 0 if it was not recorded, the size of the source and the
+ *    number of tokens, as uint64;
+ *  - flags, as uint32, and 4 bytes of padding.
+ *
+ * Every token follows as its type, in one byte, and four unsigned LEB128
+ * varints: the gap between the end of the previous token and its offset, its
+ * length, the difference between its line and that of the previous token,
+ * and its column. Tokens are thus typically 5 or 6 bytes, and the lexemes are
+ * not stored: a reader points them into the source.
+ */
+struct TokenFormat
+{
+    static constexpr char magic[8] = {'L', 'E', 'X', 'T', 'O', 'K', 'E', 'N'};
+    static constexpr std::uint32_t version = 1;
+    /// @brief Tells a file written on a host of the other byte order, whose
+    /// integers cannot be read here.
+    static constexpr std::uint32_t byte_order = 0x01020304;
+    static constexpr std::size_t header_size = 56;
+    /// @brief The flag of tokens whose positions the lexer resolves lazily.
+    static constexpr std::uint32_t lazy_positions = 1;
+
+    /**
+     * @brief The fields of the header.
+     */
+    struct Header
+    {
+        std::uint64_t rules = 0;
+        std::uint64_t source_hash = 0;
+        std::uint64_t source_size = 0;
+        std::uint64_t count = 0;
+        std::uint32_t flags = 0;
+    };
+
+    static void write_header(std::string& out, const Header& header)
+    {
+        char bytes[header_size] = {};
+
+        std::memcpy(bytes, magic, sizeof(magic));
+        std::memcpy(bytes + 8, &version, sizeof(version));
+        std::memcpy(bytes + 12, &byte_order, sizeof(byte_order));
+        std::memcpy(bytes + 16, &header.rules, 8);
+        std::memcpy(bytes + 24, &header.source_hash, 8);
+        std::memcpy(bytes + 32, &header.source_size, 8);
+        std::memcpy(bytes + 40, &header.count, 8);
+        std::memcpy(bytes + 48, &header.flags, 4);
+
+        out.replace(0, header_size, bytes, header_size);
+    }
+
+    /**
+     * @return The header, or std::nullopt if the data does not start with one
+     * of this version and byte order.
+     */
+    static std::optional<Header> read_header(std::string_view data)
+    {
+        std::uint32_t data_version;
+        std::uint32_t data_byte_order;
+        Header header;
+
+        if (data.size() < header_size ||
+            data.compare(0, sizeof(magic),
+                         std::string_view(magic, sizeof(magic))))
+            return std::nullopt;
+
+        std::memcpy(&data_version, data.data() + 8, 4);
+        std::memcpy(&data_byte_order, data.data() + 12, 4);
+
+        if (data_version != version || data_byte_order != byte_order)
+            return std::nullopt;
+
+        std::memcpy(&header.rules, data.data() + 16, 8);
+        std::memcpy(&header.source_hash, data.data() + 24, 8);
+        std::memcpy(&header.source_size, data.data() + 32, 8);
+        std::memcpy(&header.count, data.data() + 40, 8);
+        std::memcpy(&header.flags, data.data() + 48, 4);
+
+        return header;
+    }
+
+    static void write_varint(std::string& out, std::uint64_t value)
+    {
+        char bytes[10];
+        std::size_t size = 0;
+
+        while (value >= 0x80)
+        {
+            bytes[size++] = static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+
+        bytes[size++] = static_cast<char>(value);
+        out.append(bytes, size);
+    }
+
+    /**
+     * @brief Decodes a varint, checking that it ends before the end.
+     * @return False if it does not, or is longer than 64 bits.
+     */
+    static bool
+    read_varint(const char*& at, const char* end, std::uint64_t& value)
+    {
+        value = 0;
+
+        for (unsigned shift = 0; at != end && shift < 64; shift += 7)
+        {
+            auto byte = static_cast<unsigned char>(*at++);
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+
+            if (!(byte & 0x80))
+                return true;
+        }
+
+        return false;
+    }
+
+    /// @brief Decodes a varint known to be well formed.
+    static std::uint64_t read_varint(const char*& at)
+    {
+        std::uint64_t value = 0;
+
+        for (unsigned shift = 0;; shift += 7)
+        {
+            auto byte = static_cast<unsigned char>(*at++);
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+
+            if (!(byte & 0x80))
+                return value;
+        }
+    }
+};
+
+/**
+ * @brief Serializes the tokens of one input as they are produced, for
+ * instance as the sink of Lexer::next_batch() or Lexer::tokenize_into().
+ *
+ * The tokens must come in input order, as the lexer produces them, and their
+ * types must be enumerators from 0 to 255.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ */
+template <typename TokenType>
+class TokenWriter
+{
+  public:
+    /**
+     * @param rules The digest of the rules the tokens are scanned with, such
+     * as RuleSet::digest().
+     * @param flags The TokenFormat flags of the tokens.
+     */
+    explicit TokenWriter(std::uint64_t rules = 0, std::uint32_t flags = 0)
+        : m_data(TokenFormat::header_size, '\0')
+    {
+        m_header.rules = rules;
+        m_header.flags = flags;
+    }
+
+    /**
+     * @brief Appends a token.
+     *
+     * @return False if its type does not fit in a byte, in which case finish()
+     * will fail.
+     */
+    template <typename Lexeme>
+    bool write(const Token<TokenType, Lexeme>& token)
+    {
+        auto type = static_cast<std::int64_t>(token.type);
+
+        if (type < 0 || type > 0xff || token.offset < m_end)
+        {
+            m_failed = true;
+            return false;
+        }
+
+        auto line = static_cast<std::uint32_t>(token.line);
+        auto column = static_cast<std::uint32_t>(token.column);
+
+        m_data.push_back(static_cast<char>(type));
+        TokenFormat::write_varint(m_data, token.offset - m_end);
+        TokenFormat::write_varint(m_data, token.lexeme.size());
+        TokenFormat::write_varint(m_data, line - m_line);
+        TokenFormat::write_varint(m_data, column);
+
+        m_end = token.offset + token.lexeme.size();
+        m_line = line;
+        m_header.count++;
+
+        return true;
+    }
+
+    template <typename Lexeme>
+    void operator()(const Token<TokenType, Lexeme>& token)
+    {
+        write(token);
+    }
+
+    /**
+     * @brief Completes the header and returns the serialized tokens; the
+     * writer is then empty again.
+     *
+     * @param source The input the tokens were scanned from.
+     * @param hash Whether to record the hash of the source, so that a reader
+     * can tell whether it changed.
+     * @return The serialized tokens, or an empty string if a token could not
+     * be written.
+     */
+    std::string finish(std::string_view source, bool hash = true)
+    {
+        std::string data = std::move(m_data);
+        bool failed = m_failed || m_end > source.size();
+
+        m_header.source_hash = hash ? content_hash(source) : 0;
+        m_header.source_size = source.size();
+        TokenFormat::write_header(data, m_header);
+
+        *this = TokenWriter(m_header.rules, m_header.flags);
+
+        return failed ? std::string() : data;
+    }
+
+  private:
+    std::string m_data;
+    TokenFormat::Header m_header;
+    /// @brief The end of the previous token in the input.
+    std::size_t m_end = 0;
+    std::uint32_t m_line = 0;
+    bool m_failed = false;
+};
+
+/**
+ * @brief Reads serialized tokens in place, pointing their lexemes into the
+ * source they were scanned from, and iterates over them like a
+ * Lexer::TokenStream.
+ *
+ * @tparam TokenType The enum type used for classifying tokens.
+ */
+template <typename TokenType>
+class TokenReader
+{
+  public:
+    /**
+     * @brief An input iterator decoding one token per step.
+     */
+    class Iterator
+    {
+      public:
+        using value_t = TokenView<TokenType>;
+        using token_r = const value_t&;
+        using token_p = const value_t*;
+        using it_cat = std::input_iterator_tag;
+        using diff_t = std::ptrdiff_t;
+
+        Iterator(const TokenReader* reader)
+            : m_reader(reader)
+            , m_at(reader->m_data.data() + TokenFormat::header_size)
+            , m_left(reader->m_header.count)
+        {
+            advance();
+        }
+
+        Iterator()
+            : m_reader(nullptr)
+        {}
+
+        token_r operator*() const { return m_current; }
+        token_p operator->() const { return &m_current; }
+
+        Iterator& operator++()
+        {
+            advance();
+            return *this;
+        }
+
+        Iterator operator++(int)
+        {
+            Iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+        bool operator==(const Iterator& other) const
+        {
+            return m_reader == other.m_reader &&
+                   (!m_reader || m_left == other.m_left);
+        }
+
+        bool operator!=(const Iterator& other) const
+        {
+            return !(*this == other);
+        }
+
+      private:
+        /**
+         * @brief Decodes the next token, or becomes the end iterator.
+         */
+        void advance()
+        {
+            if (!m_reader)
+                return;
+
+            if (m_left == 0)
+            {
+                m_reader = nullptr;
+                return;
+            }
+
+            auto type = static_cast<unsigned char>(*m_at++);
+            std::size_t offset = m_end + TokenFormat::read_varint(m_at);
+            std::size_t length = TokenFormat::read_varint(m_at);
+            auto line = TokenFormat::read_varint(m_at);
+            auto column =
+                static_cast<std::uint32_t>(TokenFormat::read_varint(m_at));
+
+            m_current = {
+                .type = static_cast<TokenType>(type),
+                .lexeme = m_reader->m_source.substr(offset, length),
+                .line = static_cast<int>(m_line + line),
+                .column = static_cast<int>(column),
+                .offset = offset,
+            };
+
+            m_end = offset + length;
+            m_line += static_cast<std::uint32_t>(line);
+            m_left--;
+        }
+
+        const TokenReader* m_reader;
+        const char* m_at = nullptr;
+        std::uint64_t m_left = 0;
+        std::size_t m_end = 0;
+        std::uint32_t m_line = 0;
+        value_t m_current = {};
+    };
+
+    /**
+     * @brief Opens serialized tokens without copying them.
+     *
+     * The whole sequence is checked once here, so that iterating needs no
+     * checks.
+     *
+     * @param data The serialized tokens.
+     * @param source The input they were scanned from.
+     * @param owner Keeps the memory of data alive for as long as the reader
+     * exists; may be null if the caller does.
+     * @return The reader, or std::nullopt if the data is malformed, of another
+     * version, or does not fit the source.
+     */
+    static std::optional<TokenReader> open(std::string_view data,
+                                           std::string_view source,
+                                           std::shared_ptr<const void> owner =
+                                               nullptr)
+    {
+        auto header = TokenFormat::read_header(data);
+
+        if (!header || header->source_size != source.size())
+            return std::nullopt;
+
+        const char* at = data.data() + TokenFormat::header_size;
+        const char* end = data.data() + data.size();
+        std::uint64_t position = 0;
+
+        for (std::uint64_t i = 0; i < header->count; i++)
+        {
+            std::uint64_t gap, length, line, column;
+
+            if (at == end)
+                return std::nullopt;
+
+            at++;
+
+            if (!TokenFormat::read_varint(at, end, gap) ||
+                !TokenFormat::read_varint(at, end, length) ||
+                !TokenFormat::read_varint(at, end, line) ||
+                !TokenFormat::read_varint(at, end, column) ||
+                gap > source.size() - position ||
+                length > source.size() - position - gap)
+                return std::nullopt;
+
+            position += gap + length;
+        }
+
+        if (at != end)
+            return std::nullopt;
+
+        TokenReader reader;
+        reader.m_data = data;
+        reader.m_source = source;
+        reader.m_header = *header;
+        reader.m_owner = std::move(owner);
+
+        return reader;
+    }
+
+    /**
+     * @brief Opens a file of serialized tokens, which stays mapped for as long
+     * as the reader exists.
+     *
+     * @param filepath The path to the file.
+     * @param source The input the tokens were scanned from.
+     * @return The reader, or std::nullopt if the file cannot be read or is
+     * rejected by open().
+     */
+    static std::optional<TokenReader> load(const std::string& filepath,
+                                           std::string_view source)
+    {
+        auto file = std::make_shared<MappedFile>();
+
+        if (!file->open(filepath))
+            return std::nullopt;
+
+        std::string_view data = file->content();
+
+        return open(data, source, std::move(file));
+    }
+
+    Iterator begin() const { return Iterator(this); }
+    Iterator end() const { return Iterator(); }
+
+    /// @brief The number of tokens.
+    std::size_t size() const { return m_header.count; }
+
+    /// @brief The digest of the rules the tokens were scanned with.
+    std::uint64_t rules() const { return m_header.rules; }
+
+    /// @brief The hash of the source, or 0 if it was not recorded.
+    std::uint64_t source_hash() const { return m_header.source_hash; }
+
+    /// @brief The TokenFormat flags of the tokens.
+    std::uint32_t flags() const { return m_header.flags; }
+
+  private:
+    std::string_view m_data;
+    std::string_view m_source;
+    TokenFormat::Header m_header;
+    std::shared_ptr<const void> m_owner;
+};
+
+/**
+ * @brief A directory of serialized tokens, keyed by the hash of the content
+ * they were scanned from and the digest of the rules, so that unchanged
+ * inputs are loaded rather than scanned again.
+ *
+ * An entry takes a byte for the type of every token and a few for its
+ * position and length, so for inputs made of short tokens it can be larger
+ * than the source itself; the cache trades disk space for not scanning.
+ *
+ * See Lexer::tokenize_file().
+ */
+class TokenCache
+{
+  public:
+    /**
+     * @param directory The directory the entries are kept in. It must exist.
+     */
+    explicit TokenCache(std::string directory)
+        : m_directory(std::move(directory))
+    {}
+
+    /// @brief The directory the entries are kept in.
+    const std::string& directory() const { return m_directory; }
+
+    /**
+     * @brief The path of the entry for a source, a set of rules and the
+     * TokenFormat flags of the tokens.
+     */
+    std::string path(std::uint64_t source_hash,
+                     std::uint64_t rules,
+                     std::uint32_t flags) const
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "%016llx-%016llx-%x.tokens",
+                      static_cast<unsigned long long>(source_hash),
+                      static_cast<unsigned long long>(rules), flags);
+
+        return m_directory + "/" + name;
+    }
+
+    /**
+     * @brief Loads the entry for a source, if there is a current one.
+     *
+     * @param source The input.
+     * @param source_hash The content_hash() of the input.
+     * @param rules The digest of the rules.
+     * @param flags The TokenFormat flags the tokens must have been saved with.
+     * @return The reader, or std::nullopt on a miss.
+     */
+    template <typename TokenType>
+    std::optional<TokenReader<TokenType>> load(std::string_view source,
+                                               std::uint64_t source_hash,
+                                               std::uint64_t rules,
+                                               std::uint32_t flags) const
+    {
+        auto reader = TokenReader<TokenType>::load(
+            path(source_hash, rules, flags), source);
+
+        if (!reader || reader->source_hash() != source_hash ||
+            reader->rules() != rules || reader->flags() != flags)
+            return std::nullopt;
+
+        return reader;
+    }
+
+    /**
+     * @brief Saves an entry with replace_file(), so that a concurrent load
+     * never sees it half written and concurrent stores of the same entry do
+     * not write into each other's file.
+     *
+     * @param data Serialized tokens, as returned by TokenWriter::finish().
+     * @param source_hash The content_hash() of the input.
+     * @param rules The digest of the rules.
+     * @param flags The TokenFormat flags of the tokens.
+     * @return False if the entry could not be written.
+     */
+    bool store(const std::string& data,
+               std::uint64_t source_hash,
+               std::uint64_t rules,
+               std::uint32_t flags) const
+    {
+        if (data.empty())
+            return false;
+
+        return replace_file(path(source_hash, rules, flags), data);
+    }
+
+  private:
+    std::string m_directory;
+};